@@ -1,11 +1,15 @@
 #include <string.h>
 #include "driver_init.h"
 #include "can_control.h"
+#include "tick.h"
+#include "commands.h"
+#include "latch.h"
 
 bool can_tx_completed = true;
 bool can_rx_completed = false;
 
 typedef struct {
+  //* First member, so word-aligned for io_append_block()
   uint8_t buf[CAN_MAX_TXFR];
   //* Number of bytes in the buffer. Must be <= len and must be equal
   //* to len before processing begins starts
@@ -24,14 +28,37 @@ typedef struct {
   bool err_flagged;
   //* Indicates the message is being built
   bool in_progress;
+  //* Request arrived in FD frames, or reply is to be sent in FD frames
+  bool fd;
+  //* Request is complete and waiting in can_req_q for its reply
+  bool queued;
+  //* Request was addressed to CAN_BROADCAST_ID
+  bool broadcast;
+  //* Timestamp of the frame that completed the request
+  uint16_t rx_ts;
 } can_io_buf;
-static can_io_buf send_buf, recv_buf;
+static can_io_buf send_buf;
+
+/**
+ * Request contexts. Requests are reassembled in their own context,
+ * keyed by CAN ID (and hence REQID), so a host may interleave frames
+ * of several outstanding requests. Completed requests are answered in
+ * the order they completed.
+ */
+#define CAN_MAX_REQS 4
+static can_io_buf recv_bufs[CAN_MAX_REQS];
+static can_io_buf *can_req_q[CAN_MAX_REQS];
+static uint8_t can_req_q_head = 0;
+static uint8_t can_req_q_count = 0;
 
 static void io_buf_init(can_io_buf *io) {
   io->nc = io->cp = io->len = 0;
   io->id = io->cmd = io->seq = 0;
   io->err_flagged = false;
   io->in_progress = false;
+  io->fd = false;
+  io->queued = false;
+  io->broadcast = false;
 }
 
 /**
@@ -50,6 +77,53 @@ static bool io_append(can_io_buf *io, uint8_t *src, int len) {
   return false;
 }
 
+/**
+ * @brief Add words read from the subbus to the specified buffer
+ * @param io Pointer to buffer structure. io->nc must be even.
+ * @param addr The first subbus address
+ * @param count The number of words to read. The caller must ensure
+ *   they fit within io->len.
+ * @param increment true to read successive addresses
+ * @return The number of words acknowledged
+ */
+static int io_append_block(can_io_buf *io, uint16_t addr, int count,
+      bool increment) {
+  int nr = subbus_read_block(addr, count, increment,
+                             (uint16_t*)&io->buf[io->nc]);
+  io->nc += nr*sizeof(uint16_t);
+  return nr;
+}
+
+/**
+ * @brief Add the words at a list of addresses to the specified buffer
+ *
+ * Runs of consecutive addresses are read as a single block.
+ * @param io Pointer to buffer structure. io->nc must be even.
+ * @param addrs The addresses
+ * @param n The number of addresses. The caller must ensure the words
+ *   fit within io->len.
+ * @param nack_addr Set to the first address not acknowledged
+ * @return true if some address was not acknowledged
+ */
+static bool io_append_list(can_io_buf *io, const uint8_t *addrs, int n,
+      uint8_t *nack_addr) {
+  int i = 0;
+  while (i < n) {
+    uint8_t addr = addrs[i++];
+    int nw = 1, nr;
+    while (i < n && addrs[i] == addr+nw) {
+      ++i;
+      ++nw;
+    }
+    nr = io_append_block(io, addr, nw, true);
+    if (nr < nw) {
+      *nack_addr = addr+nr;
+      return true;
+    }
+  }
+  return false;
+}
+
 /**
  * @brief Setup an can_io_buf structure for a new message
  * @param io Pointer to buffer structure
@@ -79,7 +153,7 @@ static bool io_msg_init(can_io_buf *io, uint16_t id, uint8_t cmd, int len) {
  * @param id The message id to compare to
  * @return true if message has already been flagged
  */
-static bool io_msg_flagged(can_io_buf *io, uint8_t id) {
+static bool io_msg_flagged(can_io_buf *io, uint16_t id) {
   if (io->id == id && io->err_flagged) {
     return true;
   } else {
@@ -89,41 +163,318 @@ static bool io_msg_flagged(can_io_buf *io, uint8_t id) {
   }
 }
 
+static void service_can_request(bool new_request);
+static bool can_tx_refill(void);
+/** Counts replies started by service_can_request() */
+static uint16_t can_replies_started = 0;
+static void can_fd_pad(struct can_message *msg);
+struct can_rxq_entry;
+static bool can_isr_latch(struct can_rxq_entry *e);
+#if CAN_ISR_READS
+static bool can_isr_read(struct can_rxq_entry *e);
+#endif
+
+/**
+ * A TX FIFO slot has been freed. If a multi-frame response is stalled
+ * waiting for space, refill from send_buf right here so the segments
+ * go out back-to-back rather than at main loop speed.
+ */
 static void CAN_CTRL_tx_callback(struct can_async_descriptor *const descr) {
   can_tx_completed = true;
+  if (can_tx_refill()) {
+    service_can_request(false);
+  }
+  subbus_mark_ready(&sb_can);
 	(void)descr;
 }
 
+/**
+ * Software receive queue. Frames are moved here from RX FIFO 0 by
+ * CAN_CTRL_rx_callback() so the hardware FIFO rarely fills while the
+ * main loop is busy elsewhere. The ISR is the only producer and
+ * can_control_read() the only consumer.
+ */
+#define CAN_RXQ_SIZE 32 // Must be a power of 2
+typedef struct can_rxq_entry {
+  uint32_t id;
+  uint8_t len;
+  uint8_t fmt;
+  uint8_t type;
+  uint16_t ts;
+  uint8_t data[CAN_FD_DLEN];
+} can_rxq_entry;
+static can_rxq_entry can_rxq[CAN_RXQ_SIZE];
+static volatile uint8_t can_rxq_head = 0; // Next entry to fill
+static volatile uint8_t can_rxq_tail = 0; // Next entry to read
+
+/**
+ * A remote frame with can_rtr_id releases the dedicated TX buffers in
+ * can_rtr_mask. See can_control_set_remote().
+ */
+static volatile uint16_t can_rtr_id = 0;
+static volatile uint8_t can_rtr_mask = 0;
+
+/**
+ * Moves frames from RX FIFO 0 into the software queue until either is
+ * exhausted. Frames that do not fit stay in the hardware FIFO. Must
+ * not be interrupted by CAN_CTRL_rx_callback().
+ */
+static void can_rxq_fill(void) {
+  struct can_message msg;
+  uint8_t next, depth;
+  for (;;) {
+    next = (can_rxq_head+1) & (CAN_RXQ_SIZE-1);
+    if (next == can_rxq_tail) break;
+    msg.data = can_rxq[can_rxq_head].data;
+    msg.type = CAN_TYPE_DATA; // _can_async_read() only sets REMOTE
+    if (can_async_read(&CAN_CTRL, &msg) != ERR_NONE) break;
+    can_rxq[can_rxq_head].id = msg.id;
+    can_rxq[can_rxq_head].len = msg.len;
+    can_rxq[can_rxq_head].fmt = msg.fmt;
+    can_rxq[can_rxq_head].type = msg.type;
+    can_rxq[can_rxq_head].ts = msg.timestamp;
+    if (msg.type == CAN_TYPE_REMOTE) {
+      // Remote frames are never requests. See can_control_set_remote().
+      if (can_rtr_mask && msg.id == can_rtr_id &&
+          msg.fmt == CAN_FMT_STDID) {
+        can_async_send_tx_buffers(&CAN_CTRL, can_rtr_mask);
+      }
+      continue;
+    }
+    if (can_isr_latch(&can_rxq[can_rxq_head])) continue;
+#if CAN_ISR_READS
+    if (can_isr_read(&can_rxq[can_rxq_head])) continue;
+#endif
+    can_rxq_head = next;
+  }
+  depth = (can_rxq_head - can_rxq_tail) & (CAN_RXQ_SIZE-1);
+  if (depth > sb_can.cache[6]) {
+    sb_can.cache[6] = depth;
+  }
+}
+
 static void CAN_CTRL_rx_callback(struct can_async_descriptor *const descr) {
   can_rx_completed = true;
+  can_rxq_fill();
+  subbus_mark_ready(&sb_can);
   (void)descr;
 }
 
-int32_t can_control_read(struct can_message *msg) {
+/**
+ * Handles emergency frames routed to RX FIFO 1 by filter 3. Runs in
+ * interrupt context and acts on the pins directly, so the response
+ * does not wait for the main loop or the RX FIFO 0 queue.
+ */
+static void CAN_CTRL_rx1_callback(struct can_async_descriptor *const descr) {
+  struct can_message msg;
+  uint8_t data[8];
+  msg.data = data;
+  for (;;) {
+    uint8_t bd;
+    msg.type = CAN_TYPE_DATA; // _can_async_read_fifo1() only sets REMOTE
+    if (can_async_read_fifo1(descr, &msg) != ERR_NONE) break;
+    bd = CAN_ID_REQID(msg.id);
+    if (msg.type == CAN_TYPE_DATA && msg.len >= 1 &&
+        (bd == CAN_BROADCAST_ID || bd == CAN_BOARD_ID)) {
+      cmd_emergency(data[0]);
+    }
+  }
+}
+
+static void CAN_CTRL_irq_callback(struct can_async_descriptor *const descr,
+      enum can_async_interrupt_type type) {
+  if (type == CAN_IRQ_DO) {
+    ++sb_can.cache[5];
+  }
+  (void)descr;
+}
+
+/**
+ * @brief Describes the next received frame without copying it
+ * @param msg Set to the frame. msg->data points into the software
+ *   queue and stays valid until can_rxq_release().
+ * @return ERR_NOT_FOUND if no frame is waiting
+ */
+static int32_t can_rxq_peek(struct can_message *msg) {
+  can_rxq_entry *e;
   can_rx_completed = false;
-  return can_async_read(&CAN_CTRL, msg);
+  // Pull in anything left in the hardware FIFO, either because the
+  // queue was full or because a frame arrived as the ISR was exiting.
+  CRITICAL_SECTION_ENTER()
+  can_rxq_fill();
+  CRITICAL_SECTION_LEAVE()
+  if (can_rxq_tail == can_rxq_head) {
+    return ERR_NOT_FOUND;
+  }
+  e = &can_rxq[can_rxq_tail];
+  msg->id = e->id;
+  msg->len = e->len;
+  msg->fmt = e->fmt;
+  msg->type = e->type;
+  msg->timestamp = e->ts;
+  msg->data = e->data;
+  return ERR_NONE;
+}
+
+/**
+ * Returns the frame from can_rxq_peek() to the queue
+ */
+static void can_rxq_release(void) {
+  can_rxq_tail = (can_rxq_tail+1) & (CAN_RXQ_SIZE-1);
+}
+
+/**
+ * @brief Retrieves the next received frame from the software queue
+ * @param msg Message structure. msg->data must have room for
+ *   CAN_FD_DLEN bytes.
+ * @return ERR_NOT_FOUND if no frame is waiting
+ */
+int32_t can_control_read(struct can_message *msg) {
+  struct can_message qmsg;
+  int32_t rv = can_rxq_peek(&qmsg);
+  if (rv == ERR_NONE) {
+    msg->id = qmsg.id;
+    msg->len = qmsg.len;
+    msg->fmt = qmsg.fmt;
+    msg->type = qmsg.type;
+    msg->timestamp = qmsg.timestamp;
+    memcpy(msg->data, qmsg.data, qmsg.len);
+    can_rxq_release();
+  }
+  return rv;
 }
 
 /**
  * @brief Enqueues data for CAN transmission
  * @param ID The CAN ID for the message
  * @param data Pointer to the data
- * @param nb The number of bytes of data (0-8)
+ * @param nb The number of bytes of data (0-8, or up to CAN_FD_DLEN
+ *   if the host has enabled CAN FD)
  * @return
  */
 int32_t can_control_write(uint16_t ID, uint8_t *data, int nb) {
 	struct can_message msg;
+  int32_t rv = ERR_NO_RESOURCE;
 
-  if (nb < 0 || nb > 8) {
+  if (nb < 0 || nb > CAN_FD_DLEN) {
     return ERR_WRONG_LENGTH;
   }
 	msg.id   = ID;
 	msg.type = CAN_TYPE_DATA;
-	msg.data = data;
 	msg.len  = nb;
 	msg.fmt  = CAN_FMT_STDID;
   can_tx_completed = false;
-	return can_async_write(&CAN_CTRL, &msg);
+  // CAN_CTRL_tx_callback() may also be writing to the TX FIFO
+  CRITICAL_SECTION_ENTER()
+  msg.data = can_async_tx_buffer(&CAN_CTRL);
+  if (msg.data) {
+    memcpy(msg.data, data, nb);
+    if (nb > CAN_CLASSIC_DLEN) {
+      can_fd_pad(&msg);
+    }
+    rv = can_async_tx_commit(&CAN_CTRL, &msg);
+  }
+  CRITICAL_SECTION_LEAVE()
+  return rv;
+}
+
+/**
+ * @return The CAN timestamp counter. It advances every
+ *   CONF_CAN1_TSCC_TCP CAN bit times and is the timebase of the
+ *   reception times of received frames.
+ */
+uint16_t can_control_timestamp(void) {
+  return can_async_get_timestamp(&CAN_CTRL);
+}
+
+static uint16_t can_ts_cache[CAN_TS_HIGH_ADDR-CAN_TS_BASE_ADDR+1];
+
+/**
+ * Records the timing of a request that has just been answered
+ * @param rx_ts The reception timestamp of its last frame
+ */
+static void can_ts_record(uint16_t rx_ts) {
+  uint16_t latency = can_control_timestamp() - rx_ts;
+  CRITICAL_SECTION_ENTER()
+  can_ts_cache[0] = rx_ts;
+  can_ts_cache[1] = latency;
+  if (latency > can_ts_cache[2]) {
+    can_ts_cache[2] = latency;
+  }
+  CRITICAL_SECTION_LEAVE()
+}
+
+/**
+ * @brief Loads a frame into a dedicated TX buffer without sending it
+ * @param index The buffer, below CAN_STAGE_BUFFERS
+ * @param ID The CAN ID for the frame
+ * @param data Pointer to the data
+ * @param nb The number of bytes of data, as for can_control_write()
+ * @return ERR_BUSY if the buffer's previous frame has not gone out yet
+ */
+int32_t can_control_stage(uint8_t index, uint16_t ID, uint8_t *data, int nb) {
+	struct can_message msg;
+  uint8_t fd_data[CAN_FD_DLEN];
+
+  if (nb < 0 || nb > CAN_FD_DLEN) {
+    return ERR_WRONG_LENGTH;
+  }
+  if (index >= CAN_STAGE_BUFFERS) {
+    return ERR_INVALID_ARG;
+  }
+	msg.id   = ID;
+	msg.type = CAN_TYPE_DATA;
+	msg.data = data;
+	msg.len  = nb;
+	msg.fmt  = CAN_FMT_STDID;
+  if (nb > CAN_CLASSIC_DLEN) {
+    memcpy(fd_data, data, nb);
+    msg.data = fd_data;
+    can_fd_pad(&msg);
+  }
+  return can_async_set_tx_buffer(&CAN_CTRL, index, &msg);
+}
+
+/**
+ * @brief Lets a remote frame release staged frames
+ * When a remote frame with this ID arrives, the receive interrupt
+ * requests transmission of the dedicated TX buffers in mask as they
+ * stand, with no formatting. Standard filter element 2 is set to pass
+ * the ID.
+ * @param ID The CAN ID of the remote frame, normally the ID the staged
+ *   frames carry
+ * @param mask Bit n selects buffer n. 0 stops answering remote frames.
+ */
+void can_control_set_remote(uint16_t ID, uint8_t mask) {
+  struct can_filter filter;
+  can_rtr_mask = 0;
+  can_rtr_id = ID;
+  if (mask) {
+    filter.id = ID;
+    filter.mask = CAN_ID_BOARD_MASK | CAN_ID_REPLY_BIT | CAN_ID_REQID_MASK;
+    can_async_set_filter(&CAN_CTRL, 2, CAN_FMT_STDID, &filter);
+  } else {
+    can_async_set_filter(&CAN_CTRL, 2, CAN_FMT_STDID, NULL);
+  }
+  can_rtr_mask = mask;
+}
+
+/**
+ * @return true if the host has enabled CAN FD frames for this board
+ */
+bool can_control_fd(void) {
+  return sb_can.cache[CAN_FD_ADDR-CAN_BASE_ADDR] != 0;
+}
+
+/**
+ * Increments a counter in can_cache from the main loop. can_isr_read()
+ * and can_isr_latch() update the same counters from the receive
+ * interrupt, so the read-modify-write is done with interrupts held off.
+ */
+static void can_count(int offset) {
+  CRITICAL_SECTION_ENTER()
+  ++sb_can.cache[offset];
+  CRITICAL_SECTION_LEAVE()
 }
 
 static void record_can_error(int32_t err) {
@@ -133,109 +484,226 @@ static void record_can_error(int32_t err) {
     bits = 1 << err;
   } else if (err >= 16 && err <= 31) {
     bits = 1 << (err-16);
-    sb_can.cache[1].cache |= bits;
+    sb_can.cache[1] |= bits;
     return;
   } else {
     bits = 1;
   }
-  sb_can.cache[0].cache |= bits;
+  sb_can.cache[0] |= bits;
 }
 
 static struct {
-    uint8_t odata[8];
-    struct can_message omsg;
-    bool tx_blocked;
-    bool pending;
+    volatile bool tx_blocked;
+    volatile bool pending;
   } cur_req;
 
+/**
+ * @return true if a response is waiting for TX FIFO space
+ */
+static bool can_tx_refill(void) {
+  return cur_req.pending && cur_req.tx_blocked;
+}
+
 static void can_send_error_1(uint16_t id, uint8_t err_code, uint8_t arg);
 static void can_send_error_2(uint16_t id, uint8_t err_code, uint8_t arg1,
          uint8_t arg2);
 
-static void cur_req_init(uint32_t id, uint8_t cmd, uint8_t len) {
-  // cur_req.cmd = cmd;
-  cur_req.omsg.id = id | CAN_ID_REPLY_BIT;
-  cur_req.omsg.type = CAN_TYPE_DATA;
-  cur_req.omsg.fmt = CAN_FMT_STDID;
-  cur_req.omsg.data = cur_req.odata;
-  cur_req.tx_blocked = false;
-  cur_req.pending = false;
-  cur_req.odata[0] = cmd;
-  cur_req.odata[1] = len;
-  cur_req.omsg.len = 2;
+/**
+ * Zero-fills an FD frame up to the next valid FD data length. The host
+ * knows the true reply length from the header byte and ignores the pad.
+ */
+static void can_fd_pad(struct can_message *msg) {
+  static const uint8_t fd_len[] = { 12, 16, 20, 24, 32, 48, 64 };
+  int i;
+  for (i = 0; fd_len[i] < msg->len; ++i);
+  memset(&msg->data[msg->len], 0, fd_len[i] - msg->len);
+  msg->len = fd_len[i];
 }
 
 /**
  * Services transmission in progress. The raw message to be transmitted
- * is in send_buf. service_can_request() is responsible for configuring
- * cur_req.omsg for each packet and sending. If the send fails, we
- * set tx_blocked and leave everything where it is, so the send can be
- * retried later.
- * pending is set to inhibit accepting new requests while the transmission
+ * is in send_buf. service_can_request_locked() formats each frame
+ * directly in the next TX FIFO element, so reply data is copied once,
+ * from send_buf to message RAM. If the FIFO is full, we set tx_blocked
+ * and leave send_buf where it is, so the frame can be built from
+ * CAN_CTRL_tx_callback() as soon as a TX FIFO slot frees up.
+ * pending is set to inhibit starting another reply while the transmission
  * is in process.
+ * @param new_request true if send_buf has just been set up
  */
-static void service_can_request(bool new_request) {
-  if (cur_req.tx_blocked) {
-    uint32_t rv = can_async_write(&CAN_CTRL,&cur_req.omsg);
-    switch (rv) {
-      case ERR_NONE:
-        cur_req.tx_blocked = false;
-        break;
-      default:
-        record_can_error(rv);
-        return;
-    }
-    if (send_buf.cp >= send_buf.nc) {
-      cur_req.pending = false;
-      recv_buf.err_flagged = false;
-      send_buf.in_progress = false;
+static void service_can_request_locked(bool new_request) {
+  if (new_request) {
+    ++can_replies_started;
+  }
+  cur_req.pending = true;
+  cur_req.tx_blocked = false;
+  // The first frame carries the reply length and is sent even if the
+  // reply is empty.
+  while (send_buf.seq == 0 || send_buf.cp < send_buf.nc) {
+    struct can_message msg;
+    int nb_msg;
+    int32_t rv;
+    msg.data = can_async_tx_buffer(&CAN_CTRL);
+    if (msg.data == 0) {
+      record_can_error(ERR_NO_RESOURCE);
+      cur_req.tx_blocked = true;
       return;
     }
-  }
-  do {
-    if (send_buf.cp == 0) {
-      send_buf.seq = 1;
-      cur_req_init(send_buf.id, send_buf.cmd, send_buf.len);
-      cur_req.pending = true;
+    msg.id = send_buf.id | CAN_ID_REPLY_BIT;
+    msg.type = CAN_TYPE_DATA;
+    msg.fmt = CAN_FMT_STDID;
+    if (send_buf.seq == 0) {
+      msg.data[0] = send_buf.cmd;
+      msg.data[1] = send_buf.len;
+      msg.len = 2;
     } else {
-      cur_req.odata[0] = send_buf.cmd | CAN_SEQ_CMD(send_buf.seq++);
-      cur_req.omsg.len = 1;
+      msg.data[0] = send_buf.cmd | CAN_SEQ_CMD(send_buf.seq);
+      msg.len = 1;
     }
-    { int nb_msg = 8 - cur_req.omsg.len;
-      if (send_buf.cp + nb_msg > send_buf.nc) {
-        nb_msg = send_buf.nc - send_buf.cp;
-      }
-      if (nb_msg) {
-        memcpy(&cur_req.odata[cur_req.omsg.len], &send_buf.buf[send_buf.cp], nb_msg);
-        cur_req.omsg.len += nb_msg;
-        send_buf.cp += nb_msg;
-      }
+    nb_msg = (send_buf.fd ? CAN_FD_DLEN : CAN_CLASSIC_DLEN) - msg.len;
+    if (send_buf.cp + nb_msg > send_buf.nc) {
+      nb_msg = send_buf.nc - send_buf.cp;
     }
-    { uint32_t rv;
-      rv = can_async_write(&CAN_CTRL, &cur_req.omsg);
-      if (rv != ERR_NONE) {
-        record_can_error(rv);
-        if (rv == ERR_NO_RESOURCE) {
-          cur_req.tx_blocked = true;
-        } else {
-          can_send_error_2(cur_req.omsg.id, CAN_ERR_OTHER, send_buf.cmd, -rv);
-        }
-        return;
-      }
+    memcpy(&msg.data[msg.len], &send_buf.buf[send_buf.cp], nb_msg);
+    msg.len += nb_msg;
+    if (msg.len > CAN_CLASSIC_DLEN) {
+      can_fd_pad(&msg);
+    }
+    rv = can_async_tx_commit(&CAN_CTRL, &msg);
+    if (rv != ERR_NONE) {
+      record_can_error(rv);
+      can_send_error_2(msg.id, CAN_ERR_OTHER, send_buf.cmd, -rv);
+      return;
     }
-  } while (send_buf.cp < send_buf.nc);
+    send_buf.cp += nb_msg;
+    ++send_buf.seq;
+    ++sb_can.cache[4];
+  }
   cur_req.pending = false;
-  cur_req.tx_blocked = false;
-  recv_buf.err_flagged = false;
+  send_buf.err_flagged = false;
   send_buf.in_progress = false;
 }
 
+/**
+ * Called both from the main loop and from the TX complete interrupt.
+ * Interrupts are held off so the two cannot interleave on send_buf
+ * and cur_req. At most one FIFO's worth of frames is copied per call.
+ */
+static void service_can_request(bool new_request) {
+  CRITICAL_SECTION_ENTER()
+  service_can_request_locked(new_request);
+  CRITICAL_SECTION_LEAVE()
+}
+
+/**
+ * Takes the latch snapshot as soon as a broadcast write to
+ * LATCH_TRIGGER_ADDR is received, rather than when the main loop gets
+ * to the request, which may be tens of milliseconds later and differs
+ * from board to board. Broadcast writes are never answered, so the
+ * frame is consumed here. Called with CAN interrupts held off from
+ * can_rxq_fill().
+ * @param e The frame just received
+ * @return true if the frame was a latch trigger
+ */
+static bool can_isr_latch(can_rxq_entry *e) {
+  if (!CAN_REQUEST_MATCH(e->id,CAN_BROADCAST_ID) ||
+      e->fmt != CAN_FMT_STDID || e->type != CAN_TYPE_DATA ||
+      e->len < 5 || e->data[1] != 3 || e->data[2] != LATCH_TRIGGER_ADDR ||
+      (e->data[0] != CAN_CMD_CODE_WR_INC &&
+       e->data[0] != CAN_CMD_CODE_WR_NOINC)) {
+    return false;
+  }
+  latch_trigger(e->ts);
+  ++sb_can.cache[3];
+  return true;
+}
+
+#if CAN_ISR_READS
+/**
+ * Answers a CAN_CMD_CODE_RD request on the spot if it fits in one frame,
+ * its reply fits in one frame, and every address is a plain cache word
+ * (see subbus_peek_isr()). Requests with the same ID that are still in
+ * the queue, being reassembled, or being answered keep their order by
+ * sending this one down the normal path as well. While the replay
+ * cache is enabled, every request takes the normal path so that its
+ * reply is recorded and a retry is answered from the cache. The reads
+ * only take effect once the reply is committed, so a request that is
+ * deferred part way through is read once, by the main loop. Called
+ * with CAN interrupts held off from can_rxq_fill().
+ * @param e The frame just received
+ * @return true if the request has been answered
+ */
+static bool can_isr_read(can_rxq_entry *e) {
+  uint8_t *data;
+  struct can_message msg;
+  bool fd = e->len > CAN_CLASSIC_DLEN;
+  int i, nc;
+  uint8_t q;
+  if (!CAN_REQUEST_MATCH(e->id,CAN_BOARD_ID) ||
+      e->fmt != CAN_FMT_STDID || e->type != CAN_TYPE_DATA ||
+      e->len < 3 || e->data[0] != CAN_CMD_CODE_RD ||
+      sb_can.cache[CAN_REPLAY_ADDR-CAN_BASE_ADDR] != 0) {
+    return false;
+  }
+  nc = e->data[1];
+  if (nc == 0 || nc+2 > e->len ||
+      nc*2+2 > (fd || can_control_fd() ? CAN_FD_DLEN : CAN_CLASSIC_DLEN)) {
+    return false;
+  }
+  if (cur_req.pending && send_buf.id == e->id) {
+    return false;
+  }
+  for (i = 0; i < CAN_MAX_REQS; ++i) {
+    if (recv_bufs[i].id == e->id &&
+        (recv_bufs[i].in_progress || recv_bufs[i].queued)) {
+      return false;
+    }
+  }
+  for (q = can_rxq_tail; q != can_rxq_head; q = (q+1) & (CAN_RXQ_SIZE-1)) {
+    if (can_rxq[q].id == e->id) {
+      return false;
+    }
+  }
+  data = can_async_tx_buffer(&CAN_CTRL);
+  if (data == 0) {
+    return false;
+  }
+  for (i = 0; i < nc; ++i) {
+    uint16_t value;
+    if (!subbus_peek_isr(e->data[2+i], &value)) {
+      return false;
+    }
+    data[2+2*i] = value & 0xFF;
+    data[3+2*i] = (value >> 8) & 0xFF;
+  }
+  data[0] = CAN_CMD_CODE_RD;
+  data[1] = nc*2;
+  msg.id = e->id | CAN_ID_REPLY_BIT;
+  msg.type = CAN_TYPE_DATA;
+  msg.fmt = CAN_FMT_STDID;
+  msg.data = data;
+  msg.len = nc*2+2;
+  if (msg.len > CAN_CLASSIC_DLEN) {
+    can_fd_pad(&msg);
+  }
+  if (can_async_tx_commit(&CAN_CTRL, &msg) != ERR_NONE) {
+    return false;
+  }
+  for (i = 0; i < nc; ++i) {
+    subbus_set_read_isr(e->data[2+i]);
+  }
+  ++sb_can.cache[3];
+  ++sb_can.cache[4];
+  can_ts_record(e->ts);
+  return true;
+}
+#endif
+
 static void can_send_error_1(uint16_t id, uint8_t err_code, uint8_t arg) {
-  if (io_msg_flagged(&recv_buf, id)) {
+  if (io_msg_flagged(&send_buf, id)) {
     return;
   }
   send_buf.in_progress = false;
-  recv_buf.in_progress = false;
   io_msg_init(&send_buf, id, CAN_CMD_CODE_ERROR, 2);
   send_buf.buf[send_buf.nc++] = err_code;
   send_buf.buf[send_buf.nc++] = arg;
@@ -243,11 +711,10 @@ static void can_send_error_1(uint16_t id, uint8_t err_code, uint8_t arg) {
 }
 
 static void can_send_error_2(uint16_t id, uint8_t err_code, uint8_t arg1, uint8_t arg2) {
-  if (io_msg_flagged(&recv_buf, id)) {
+  if (io_msg_flagged(&send_buf, id)) {
     return;
   }
   send_buf.in_progress = false;
-  recv_buf.in_progress = false;
   io_msg_init(&send_buf, id, CAN_CMD_CODE_ERROR, 3);
   send_buf.buf[send_buf.nc++] = err_code;
   send_buf.buf[send_buf.nc++] = arg1;
@@ -255,100 +722,315 @@ static void can_send_error_2(uint16_t id, uint8_t err_code, uint8_t arg1, uint8_
   service_can_request(true);
 }
 
-void setup_can_response(void) {
+/**
+ * Performs the writes of a WR_INC or WR_NOINC request. req->nc must be
+ * odd: an address followed by 16-bit values, LSB first.
+ * @param req The request context
+ * @param increment true to write successive addresses
+ * @param addr Set to the first address
+ * @param nw Set to the number of words in the request
+ * @return The number of words acknowledged
+ */
+static int can_req_write(can_io_buf *req, bool increment, uint8_t *addr,
+      int *nw) {
+  uint16_t wbuf[CAN_MAX_TXFR/2];
+  uint16_t value;
+  *addr = req->buf[req->cp++];
+  *nw = 0;
+  while (req->cp+1 < req->nc) {
+    value = req->buf[req->cp++];
+    value += (req->buf[req->cp++] << 8);
+    wbuf[(*nw)++] = value;
+  }
+  return subbus_write_block(*addr, *nw, increment, wbuf);
+}
+
+/**
+ * Streaming reads. See CAN_EXT_STREAM. Frame numbers wrap in the 5-bit
+ * sequence field, which is unambiguous because the window is less than
+ * 32 frames. Bytes read but not yet acknowledged are kept in buf so
+ * they can be resent, even from FIFO registers.
+ */
+#define CAN_STREAM_BUF_SIZE 1024 // Power of 2 > window*(CAN_FD_DLEN-1)
+#define CAN_STREAM_BUF_MASK (CAN_STREAM_BUF_SIZE-1)
+static struct {
+  uint8_t buf[CAN_STREAM_BUF_SIZE];
+  uint32_t total;  // Bytes in the stream, 0 for unlimited
+  uint32_t rd_pos; // Bytes read from the subbus
+  uint32_t acked;  // Frames acknowledged
+  uint32_t sent;   // Frames sent
+  uint16_t id;     // ID of the request
+  uint8_t addr;
+  uint8_t window;
+  uint8_t frame_len; // Data bytes per frame
+  bool increment;
+  bool active;
+} can_stream;
+
+/**
+ * Reads from the subbus until at least end bytes of the stream are in
+ * can_stream.buf. On a NACK, the stream is ended with an error.
+ * @return true on success
+ */
+static bool can_stream_fill(uint32_t end) {
+  uint16_t words[16];
+  while (can_stream.rd_pos < end) {
+    int nw = (end - can_stream.rd_pos + 1)/2;
+    int nr, i;
+    if (nw > 16) nw = 16;
+    nr = subbus_read_block(can_stream.addr, nw, can_stream.increment, words);
+    for (i = 0; i < nr; ++i) {
+      can_stream.buf[can_stream.rd_pos++ & CAN_STREAM_BUF_MASK] =
+        words[i] & 0xFF;
+      can_stream.buf[can_stream.rd_pos++ & CAN_STREAM_BUF_MASK] =
+        (words[i] >> 8) & 0xFF;
+    }
+    if (can_stream.increment) {
+      can_stream.addr += nr;
+    }
+    if (nr < nw) {
+      can_stream.active = false;
+      can_send_error_2(can_stream.id, CAN_ERR_NACK, CAN_CMD_CODE_EXT,
+        can_stream.addr);
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Sends stream frames until the window is full or the TX FIFO is.
+ * Only called when no reply is pending.
+ */
+static void can_stream_service(void) {
+  while (can_stream.active &&
+         can_stream.sent - can_stream.acked < can_stream.window) {
+    uint8_t data[CAN_FD_DLEN];
+    uint32_t start = can_stream.sent * can_stream.frame_len;
+    uint32_t end = start + can_stream.frame_len;
+    uint32_t i;
+    if (can_stream.total && end > can_stream.total) {
+      end = can_stream.total;
+    }
+    if (start >= end || !can_stream_fill(end)) {
+      return;
+    }
+    data[0] = CAN_CMD_CODE_EXT | CAN_SEQ_CMD(can_stream.sent);
+    for (i = start; i < end; ++i) {
+      data[1+i-start] = can_stream.buf[i & CAN_STREAM_BUF_MASK];
+    }
+    if (can_control_write(can_stream.id | CAN_ID_REPLY_BIT, data,
+          1+end-start) != ERR_NONE) {
+      return; // CAN_CTRL_tx_callback() will mark us ready
+    }
+    ++can_stream.sent;
+    can_count(4);
+  }
+}
+
+/**
+ * @param frames The low 16 bits of the number of frames received in
+ *   order
+ * @param resume true to resend any frames after those
+ */
+static void can_stream_ack(uint16_t frames, bool resume) {
+  uint16_t delta = frames - (uint16_t)can_stream.acked;
+  if (!can_stream.active || delta > can_stream.sent - can_stream.acked) {
+    return; // Stale or bogus
+  }
+  can_stream.acked += delta;
+  if (resume) {
+    can_stream.sent = can_stream.acked;
+  }
+  if (can_stream.total &&
+      can_stream.acked * can_stream.frame_len >= can_stream.total) {
+    can_stream.active = false;
+  }
+}
+
+/**
+ * Read lists for CAN_EXT_RD_LIST, loaded through CAN_LIST_SEL_ADDR,
+ * CAN_LIST_LEN_ADDR and CAN_LIST_ADDR.
+ */
+static struct {
+  uint8_t addrs[CAN_LIST_MAX];
+  uint8_t n;
+} can_lists[CAN_N_LISTS];
+
+/**
+ * Executes a CAN_EXT_RMW request
+ * @return true if send_buf holds a reply to be sent
+ */
+static bool can_rmw_request(can_io_buf *req) {
+  uint16_t and_mask, or_mask, xor_mask, value;
+  uint8_t addr;
+  if (req->nc < 8) {
+    can_send_error_2(req->id, CAN_ERR_INVALID_CMD, req->cmd, req->nc);
+    return false;
+  }
+  and_mask = req->buf[1] + (req->buf[2] << 8);
+  or_mask = req->buf[3] + (req->buf[4] << 8);
+  xor_mask = req->buf[5] + (req->buf[6] << 8);
+  if (io_msg_init(&send_buf, req->id, req->cmd, (req->nc-7)*4)) {
+    can_send_error_1(req->id, CAN_ERR_OVERFLOW, req->cmd);
+    return false;
+  }
+  for (req->cp = 7; req->cp < req->nc; ++req->cp) {
+    addr = req->buf[req->cp];
+    if (!subbus_read(addr, &value) ||
+        io_append(&send_buf, (uint8_t*)&value, sizeof(value))) {
+      can_send_error_2(req->id, CAN_ERR_NACK, req->cmd, addr);
+      return false;
+    }
+    value = ((value & and_mask) | or_mask) ^ xor_mask;
+    if (!subbus_write(addr, value) ||
+        io_append(&send_buf, (uint8_t*)&value, sizeof(value))) {
+      can_send_error_2(req->id, CAN_ERR_NACK, req->cmd, addr);
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Executes a CAN_CMD_CODE_EXT request
+ * @return true if send_buf holds a reply to be sent
+ */
+static bool can_ext_request(can_io_buf *req) {
+  if (req->nc < 1) {
+    can_send_error_2(req->id, CAN_ERR_INVALID_CMD, req->cmd, req->nc);
+    return false;
+  }
+  switch (req->buf[0]) {
+    case CAN_EXT_STREAM:
+      if (req->nc != 6 || req->buf[3] > CAN_STREAM_MAX_WINDOW) {
+        can_send_error_2(req->id, CAN_ERR_INVALID_CMD, req->cmd, req->nc);
+        return false;
+      }
+      can_stream.id = req->id;
+      can_stream.addr = req->buf[1];
+      can_stream.increment = req->buf[2] & 1;
+      can_stream.window = req->buf[3];
+      can_stream.total = 2*(req->buf[4] + (req->buf[5] << 8));
+      can_stream.rd_pos = can_stream.acked = can_stream.sent = 0;
+      can_stream.frame_len = (send_buf.fd ? CAN_FD_DLEN : CAN_CLASSIC_DLEN)-1;
+      can_stream.active = can_stream.window != 0;
+      return false;
+    case CAN_EXT_STREAM_ACK:
+    case CAN_EXT_STREAM_RESUME:
+      if (req->nc != 3) {
+        can_send_error_2(req->id, CAN_ERR_INVALID_CMD, req->cmd, req->nc);
+        return false;
+      }
+      can_stream_ack(req->buf[1] + (req->buf[2] << 8),
+        req->buf[0] == CAN_EXT_STREAM_RESUME);
+      return false;
+    case CAN_EXT_RD_LIST:
+      if (req->nc != 2 || req->buf[1] >= CAN_N_LISTS) {
+        can_send_error_2(req->id, CAN_ERR_INVALID_CMD, req->cmd, req->nc);
+        return false;
+      } else {
+        uint8_t addr;
+        int n = can_lists[req->buf[1]].n;
+        if (io_msg_init(&send_buf, req->id, req->cmd, n*2)) {
+          can_send_error_1(req->id, CAN_ERR_OVERFLOW, req->cmd);
+          return false;
+        }
+        if (io_append_list(&send_buf, can_lists[req->buf[1]].addrs, n,
+              &addr)) {
+          can_send_error_2(req->id, CAN_ERR_NACK, req->cmd, addr);
+          return false;
+        }
+      }
+      return true;
+    case CAN_EXT_RMW:
+      return can_rmw_request(req);
+    default:
+      can_send_error_2(req->id, CAN_ERR_INVALID_CMD, req->cmd, req->buf[0]);
+      return false;
+  }
+}
+
+static void setup_can_response(can_io_buf *req) {
   uint16_t value;
   uint8_t addr;
+  int nw, nr;
   bool increment = false;
-  switch (recv_buf.cmd) {
+  can_count(3);
+  switch (req->cmd) {
     case CAN_CMD_CODE_RD:
       increment = true;
-      if (io_msg_init(&send_buf, recv_buf.id, recv_buf.cmd, recv_buf.nc*2)) {
-        can_send_error_1(recv_buf.id, CAN_ERR_OVERFLOW, recv_buf.cmd);
+      if (io_msg_init(&send_buf, req->id, req->cmd, req->nc*2)) {
+        can_send_error_1(req->id, CAN_ERR_OVERFLOW, req->cmd);
         return;
       }
-      while (recv_buf.cp < recv_buf.nc) {
-        uint8_t addr = recv_buf.buf[recv_buf.cp++];
-        if (!subbus_read(addr, &value)) {
-          can_send_error_2(recv_buf.id, CAN_ERR_NACK, recv_buf.cmd, addr);
-          return;
-        }
-        if (io_append(&send_buf, (uint8_t*)&value, sizeof(value))) {
-          can_send_error_1(recv_buf.id, CAN_ERR_OVERFLOW, recv_buf.cmd);
-          return;
-        }
+      if (io_append_list(&send_buf, req->buf, req->nc, &addr)) {
+        can_send_error_2(req->id, CAN_ERR_NACK, req->cmd, addr);
+        return;
       }
       break;
     case CAN_CMD_CODE_RD_INC:
       increment = true; // no break!
     case CAN_CMD_CODE_RD_NOINC:
     case CAN_CMD_CODE_RD_CNT_NOINC:
-      if (recv_buf.cmd == CAN_CMD_CODE_RD_CNT_NOINC) {
-        if (recv_buf.nc != 3) {
-          can_send_error_2(recv_buf.id, CAN_ERR_INVALID_CMD, recv_buf.cmd, recv_buf.nc);
+      if (req->cmd == CAN_CMD_CODE_RD_CNT_NOINC) {
+        if (req->nc != 3) {
+          can_send_error_2(req->id, CAN_ERR_INVALID_CMD, req->cmd, req->nc);
           return;
         }
-        addr = recv_buf.buf[0];
+        addr = req->buf[0];
         if (!subbus_read(addr, &value)) {
-          can_send_error_2(recv_buf.id, CAN_ERR_NACK, recv_buf.cmd, addr);
+          can_send_error_2(req->id, CAN_ERR_NACK, req->cmd, addr);
           return;
         }
-        if (value > recv_buf.buf[1]) {
-          value = recv_buf.buf[1];
+        if (value > req->buf[1]) {
+          value = req->buf[1];
         }
-        if (io_msg_init(&send_buf, recv_buf.id, recv_buf.cmd, (value+1)*2) ||
+        if (io_msg_init(&send_buf, req->id, req->cmd, (value+1)*2) ||
             io_append(&send_buf, (uint8_t*)&value, sizeof(value))) {
-          can_send_error_1(recv_buf.id, CAN_ERR_OVERFLOW, recv_buf.cmd);
+          can_send_error_1(req->id, CAN_ERR_OVERFLOW, req->cmd);
           return;
         }
-        addr = recv_buf.buf[2];
+        addr = req->buf[2];
       } else {
-        if (recv_buf.nc != 2) {
-          can_send_error_2(recv_buf.id, CAN_ERR_INVALID_CMD, recv_buf.cmd, recv_buf.nc);
+        if (req->nc != 2) {
+          can_send_error_2(req->id, CAN_ERR_INVALID_CMD, req->cmd, req->nc);
           return;
         }
-        if (io_msg_init(&send_buf, recv_buf.id, recv_buf.cmd, recv_buf.buf[0]*2)) {
-          can_send_error_1(recv_buf.id, CAN_ERR_OVERFLOW, recv_buf.cmd);
+        if (io_msg_init(&send_buf, req->id, req->cmd, req->buf[0]*2)) {
+          can_send_error_1(req->id, CAN_ERR_OVERFLOW, req->cmd);
           return;
         }
-        addr = recv_buf.buf[1];
+        addr = req->buf[1];
       }
-      {
-        while (send_buf.nc < send_buf.len) {
-          if (!subbus_read(addr, &value)) {
-            can_send_error_2(recv_buf.id, CAN_ERR_NACK, recv_buf.cmd, addr);
-            return;
-          }
-          if (io_append(&send_buf, (uint8_t*)&value, sizeof(value))) {
-            can_send_error_1(recv_buf.id, CAN_ERR_OVERFLOW, recv_buf.cmd);
-            return;
-          }
-          if (increment) {
-            ++addr;
-          }
-        }
+      nw = (send_buf.len - send_buf.nc)/2;
+      nr = io_append_block(&send_buf, addr, nw, increment);
+      if (nr < nw) {
+        can_send_error_2(req->id, CAN_ERR_NACK, req->cmd,
+          increment ? addr+nr : addr);
+        return;
       }
       break;
     case CAN_CMD_CODE_WR_INC:
       increment = true; // no break!
     case CAN_CMD_CODE_WR_NOINC:
-      if ((recv_buf.nc & 1) == 0) {
-        can_send_error_2(recv_buf.id, CAN_ERR_INVALID_CMD, recv_buf.cmd, recv_buf.nc);
+      if ((req->nc & 1) == 0) {
+        can_send_error_2(req->id, CAN_ERR_INVALID_CMD, req->cmd, req->nc);
         return;
       }
-      addr = recv_buf.buf[recv_buf.cp++];
-      while (recv_buf.cp+1 < recv_buf.nc) {
-        value = recv_buf.buf[recv_buf.cp++];
-        value += (recv_buf.buf[recv_buf.cp++] << 8);
-        if (!subbus_write(addr, value)) {
-          can_send_error_2(recv_buf.id, CAN_ERR_NACK, recv_buf.cmd, addr);
-          return;
-        }
-        if (increment) {
-          ++addr;
-        }
+      nr = can_req_write(req, increment, &addr, &nw);
+      if (nr < nw) {
+        can_send_error_2(req->id, CAN_ERR_NACK, req->cmd,
+          increment ? addr+nr : addr);
+        return;
+      }
+      if (io_msg_init(&send_buf, req->id, req->cmd, 0)) {
+        can_send_error_1(req->id, CAN_ERR_OVERFLOW, req->cmd);
+        return;
       }
-      if (io_msg_init(&send_buf, recv_buf.id, recv_buf.cmd, 0)) {
-        can_send_error_1(recv_buf.id, CAN_ERR_OVERFLOW, recv_buf.cmd);
+      break;
+    case CAN_CMD_CODE_EXT:
+      if (!can_ext_request(req)) {
         return;
       }
       break;
@@ -359,54 +1041,275 @@ void setup_can_response(void) {
   service_can_request(true);
 }
 
+/**
+ * @param io The receive buffer
+ * @param fd true if the frame was received in FD format
+ * @param nb The number of payload bytes in the frame
+ * @return nb, limited to the bytes still expected if the frame is FD
+ */
+static int can_fd_trim(can_io_buf *io, bool fd, int nb) {
+  if (fd && nb > io->len - io->nc) {
+    nb = io->len - io->nc;
+  }
+  return nb;
+}
+
+/**
+ * @param id The CAN ID of a received frame
+ * @return The context reassembling the request with this ID, or the
+ *   queued error reply for it, or NULL if there is none.
+ */
+static can_io_buf *can_req_lookup(uint16_t id) {
+  int i;
+  for (i = 0; i < CAN_MAX_REQS; ++i) {
+    can_io_buf *req = &recv_bufs[i];
+    if (req->id == id &&
+        (req->in_progress || (req->queued && req->err_flagged))) {
+      return req;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @return A context for a new request. If all contexts are busy
+ *   reassembling, one of those requests is abandoned. poll_can_control()
+ *   only reads a frame when at least one context is not queued.
+ */
+static can_io_buf *can_req_alloc(void) {
+  can_io_buf *req = 0;
+  int i;
+  for (i = 0; i < CAN_MAX_REQS; ++i) {
+    if (!recv_bufs[i].queued) {
+      req = &recv_bufs[i];
+      if (!req->in_progress) break;
+    }
+  }
+  // Note that we missed something on the abandoned request, but
+  // we've missed our opportunity to send an error msg
+  req->in_progress = false;
+  req->err_flagged = false;
+  req->broadcast = false;
+  return req;
+}
+
+static void can_req_queue(can_io_buf *req) {
+  req->in_progress = false;
+  req->queued = true;
+  can_req_q[(can_req_q_head+can_req_q_count) % CAN_MAX_REQS] = req;
+  ++can_req_q_count;
+}
+
+/**
+ * Replaces the request with an error reply to be sent in its turn.
+ * Further frames of the request are ignored until then.
+ */
+static void can_req_error(can_io_buf *req, uint16_t id, uint8_t err_code,
+      int nargs, uint8_t arg1, uint8_t arg2) {
+  req->id = id;
+  req->cmd = CAN_CMD_CODE_ERROR;
+  req->buf[0] = err_code;
+  req->buf[1] = arg1;
+  req->buf[2] = arg2;
+  req->nc = req->len = nargs+1;
+  req->err_flagged = true;
+  can_req_queue(req);
+}
+
+/**
+ * Replay cache. The last reply to each of a few recent request IDs is
+ * kept, so a retry that is identical to the original and arrives within
+ * the window set at CAN_REPLAY_ADDR is answered verbatim instead of
+ * being executed again. Read side effects and writes then happen once.
+ * Requests longer than CAN_REPLAY_REQ_MAX bytes are not cached.
+ */
+#define CAN_REPLAY_ENTRIES 4
+#define CAN_REPLAY_REQ_MAX 32
+typedef struct {
+  uint32_t tick; // tick_now() when the reply was built
+  uint16_t id;
+  uint8_t req_cmd;
+  uint8_t req_nc;
+  uint8_t req[CAN_REPLAY_REQ_MAX];
+  uint8_t cmd; // Reply cmd code
+  uint8_t nc;  // Reply length
+  bool valid;
+  uint8_t buf[CAN_MAX_TXFR];
+} can_replay_t;
+static can_replay_t can_replay[CAN_REPLAY_ENTRIES];
+
+/**
+ * @return The cached reply to an identical request, or 0
+ */
+static can_replay_t *can_replay_lookup(can_io_buf *req) {
+  uint16_t window = sb_can.cache[CAN_REPLAY_ADDR-CAN_BASE_ADDR];
+  uint32_t now = tick_now();
+  int i;
+  for (i = 0; i < CAN_REPLAY_ENTRIES; ++i) {
+    can_replay_t *e = &can_replay[i];
+    if (e->valid && e->id == req->id && now - e->tick < window &&
+        e->req_cmd == req->cmd && e->req_nc == req->nc &&
+        memcmp(e->req, req->buf, req->nc) == 0) {
+      return e;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Saves the reply just built in send_buf for req, replacing any entry
+ * for the same ID, or else the oldest.
+ */
+static void can_replay_store(can_io_buf *req) {
+  can_replay_t *e = &can_replay[0];
+  int i;
+  if (req->nc > CAN_REPLAY_REQ_MAX ||
+      sb_can.cache[CAN_REPLAY_ADDR-CAN_BASE_ADDR] == 0) {
+    return;
+  }
+  for (i = 0; i < CAN_REPLAY_ENTRIES; ++i) {
+    can_replay_t *c = &can_replay[i];
+    if (c->valid && c->id == req->id) {
+      e = c;
+      break;
+    }
+    if (!c->valid || (e->valid && c->tick - e->tick > 0x80000000)) {
+      e = c; // Free, or older than the current choice
+    }
+  }
+  e->tick = tick_now();
+  e->id = req->id;
+  e->req_cmd = req->cmd;
+  e->req_nc = req->nc;
+  memcpy(e->req, req->buf, req->nc);
+  e->cmd = send_buf.cmd;
+  e->nc = send_buf.nc;
+  memcpy(e->buf, send_buf.buf, send_buf.nc);
+  e->valid = true;
+}
+
+/**
+ * Sends the reply to the oldest completed request. Must only be called
+ * when no reply is pending, as send_buf is overwritten.
+ */
+static void can_req_respond(void) {
+  can_replay_t *replay;
+  can_io_buf *req = can_req_q[can_req_q_head];
+  can_req_q_head = (can_req_q_head+1) % CAN_MAX_REQS;
+  --can_req_q_count;
+  send_buf.fd = req->fd || can_control_fd();
+  if (req->broadcast) {
+    // No replies, not even errors. See CAN_BROADCAST_ID.
+    if ((req->cmd == CAN_CMD_CODE_WR_INC ||
+         req->cmd == CAN_CMD_CODE_WR_NOINC) && (req->nc & 1)) {
+      uint8_t addr;
+      int nw;
+      can_count(3);
+      can_req_write(req, req->cmd == CAN_CMD_CODE_WR_INC, &addr, &nw);
+    }
+  } else if (req->cmd == CAN_CMD_CODE_ERROR) {
+    send_buf.in_progress = false;
+    io_msg_init(&send_buf, req->id, CAN_CMD_CODE_ERROR, req->nc);
+    io_append(&send_buf, req->buf, req->nc);
+    send_buf.in_progress = false;
+    service_can_request(true);
+  } else if ((replay = can_replay_lookup(req))) {
+    send_buf.in_progress = false;
+    io_msg_init(&send_buf, req->id, replay->cmd, replay->nc);
+    io_append(&send_buf, replay->buf, replay->nc);
+    send_buf.in_progress = false;
+    service_can_request(true);
+  } else {
+    uint16_t started = can_replies_started;
+    setup_can_response(req);
+    if (can_replies_started != started) {
+      can_replay_store(req);
+    }
+  }
+  can_ts_record(req->rx_ts);
+  req->queued = false;
+  req->err_flagged = false;
+}
+
 static void process_can_request(struct can_message *msg) {
-  if (CAN_REQUEST_MATCH(msg->id,CAN_BOARD_ID) &&
+  can_io_buf *req;
+  bool broadcast = CAN_REQUEST_MATCH(msg->id,CAN_BROADCAST_ID);
+  // The hardware filters set up in can_control_init() only pass
+  // requests for this board and broadcasts.
+  if ((broadcast || CAN_REQUEST_MATCH(msg->id,CAN_BOARD_ID)) &&
         // msg->type == CAN_TYPE_DATA &&
         msg->fmt == CAN_FMT_STDID &&
         msg->len > 0) {
     uint8_t cmd = msg->data[0];
-    if (recv_buf.in_progress && recv_buf.id != msg->id) {
-      // Note that we missed something on the previous command
-      // But we've missed our opportunity to send an error msg
-      recv_buf.in_progress = false;
-      // don't return
-    }
-    if (recv_buf.in_progress) {
-      if (CAN_CMD_CODE(cmd) == recv_buf.cmd &&
-          CAN_CMD_SEQ(cmd) == recv_buf.seq) {
-        if (io_append(&recv_buf, &msg->data[1], msg->len-1)) {
-          can_send_error_2(msg->id, CAN_ERR_OVERFLOW, cmd, msg->data[1]);
+    // FD frames are padded up to a valid FD length, so the payload may
+    // run past the end of the request.
+    bool fd = msg->len > CAN_CLASSIC_DLEN;
+    req = can_req_lookup(msg->id);
+    if (req) {
+      if (req->err_flagged) {
+        return; // Already reporting an error for this request
+      }
+      if (CAN_CMD_CODE(cmd) == req->cmd &&
+          CAN_CMD_SEQ(cmd) == req->seq) {
+        if (io_append(req, &msg->data[1],
+              can_fd_trim(req, fd, msg->len-1))) {
+          can_req_error(req, msg->id, CAN_ERR_OVERFLOW, 2, cmd, msg->data[1]);
           return;
         }
-        ++recv_buf.seq;
+        ++req->seq;
+        req->fd |= fd;
       } else {
-        can_send_error_1(msg->id, CAN_ERR_INVALID_SEQ, cmd);
+        can_req_error(req, msg->id, CAN_ERR_INVALID_SEQ, 1, cmd, 0);
         return;
       }
-      // check cmd, sequence
-      // add data
     } else {
       // This is a new request
+      req = can_req_alloc();
+      req->fd = fd;
+      req->broadcast = broadcast;
       if (CAN_CMD_SEQ(cmd) != 0 || msg->len < 2) {
         // ACTUAL COMPLAINT: Expected seq 0 with a minimum of 2 bytes
-        can_send_error_2(msg->id, CAN_ERR_INVALID_CMD, cmd, msg->len);
+        can_req_error(req, msg->id, CAN_ERR_INVALID_CMD, 2, cmd, msg->len);
         return;
       }
-      if (io_msg_init(&recv_buf,msg->id, cmd, msg->data[1]) ||
-          io_append(&recv_buf, &msg->data[2], msg->len-2)) {
-        can_send_error_2(msg->id, CAN_ERR_OVERFLOW, cmd, msg->data[1]);
+      if (io_msg_init(req, msg->id, cmd, msg->data[1]) ||
+          io_append(req, &msg->data[2],
+              can_fd_trim(req, fd, msg->len-2))) {
+        can_req_error(req, msg->id, CAN_ERR_OVERFLOW, 2, cmd, msg->data[1]);
         return;
       }
+      req->seq = 1; // Continuation frames are numbered from 1
     }
-    if (recv_buf.nc == recv_buf.len) {
-      recv_buf.in_progress = false;
-      setup_can_response();
+    if (req->nc == req->len) {
+      req->rx_ts = msg->timestamp;
+      can_req_queue(req);
     }
-  } else {
-    can_send_error_1(msg->id, CAN_ERR_BAD_ADDRESS, msg->id);
   }
 }
 
+#if SUBBUS_INTERRUPTS
+/**
+ * @brief Sends an unsolicited frame reporting pending interrupts
+ * @param inta The current INTA value
+ * @return true if the frame was queued
+ */
+static bool can_intr_notify(uint16_t inta) {
+  uint8_t data[2];
+  int32_t rv;
+  data[0] = inta & 0xFF;
+  data[1] = (inta >> 8) & 0xFF;
+  rv = can_control_write(CAN_ID_BOARD(CAN_BOARD_ID) | CAN_ID_REPLY_BIT |
+                         CAN_INTR_REQID, data, 2);
+  if (rv != ERR_NONE) {
+    if (rv != ERR_NO_RESOURCE) {
+      record_can_error(rv);
+    }
+    return false;
+  }
+  return true;
+}
+#endif
+
 /**
  *
  */
@@ -414,68 +1317,154 @@ static void can_control_init(void) {
 	struct can_filter  filter;
 
   io_buf_init(&send_buf);
-  io_buf_init(&recv_buf);
+  { int i;
+    for (i = 0; i < CAN_MAX_REQS; ++i) {
+      io_buf_init(&recv_bufs[i]);
+    }
+  }
+  can_req_q_head = can_req_q_count = 0;
 	can_async_register_callback(&CAN_CTRL, CAN_ASYNC_TX_CB, (FUNC_PTR)CAN_CTRL_tx_callback);
 	can_async_register_callback(&CAN_CTRL, CAN_ASYNC_RX_CB, (FUNC_PTR)CAN_CTRL_rx_callback);
+	can_async_register_callback(&CAN_CTRL, CAN_ASYNC_RX1_CB, (FUNC_PTR)CAN_CTRL_rx1_callback);
+	can_async_register_callback(&CAN_CTRL, CAN_ASYNC_IRQ_CB, (FUNC_PTR)CAN_CTRL_irq_callback);
 	can_async_enable(&CAN_CTRL);
+#if SUBBUS_INTERRUPTS
+  subbus_intr_add_notify(can_intr_notify);
+#endif
   /*
-   * This should allow only messages to ID 1, unless I believe the hardware
-   * docs as far as I've followed them, in which case it will accept all
-   * addresses.
+   * Classic filters (SFID1 = id, SFID2 = mask) accept requests to this
+   * board and broadcast requests into RX FIFO 0. Everything else,
+   * including replies from other boards and extended IDs, is rejected
+   * by the GFC non-matching frame settings (CONF_CAN1_GFC_ANFS/ANFE)
+   * without raising an interrupt. Filter 2 is reserved for
+   * can_control_set_remote(). Filter 3 routes the CAN_EMERG_ID range
+   * into RX FIFO 1 for CAN_CTRL_rx1_callback(). CONF_CAN1_SIDFC_LSS
+   * must be at least the number of filters.
    */
 	filter.id   = CAN_ID_BOARD(CAN_BOARD_ID);
 	filter.mask = CAN_ID_BOARD_MASK | CAN_ID_REPLY_BIT;
 	can_async_set_filter(&CAN_CTRL, 0, CAN_FMT_STDID, &filter);
+	filter.id   = CAN_ID_BOARD(CAN_BROADCAST_ID);
+	can_async_set_filter(&CAN_CTRL, 1, CAN_FMT_STDID, &filter);
+	filter.id   = CAN_EMERG_ID(CAN_BROADCAST_ID);
+	can_async_set_priority_filter(&CAN_CTRL, 3, CAN_FMT_STDID, &filter);
 }
 
-static subbus_cache_word_t can_cache[CAN_HIGH_ADDR-CAN_BASE_ADDR+1] = {
-  { 0, 0, true,  false,  false, false, false }, // Offset 0: R: CAN_Error_0
-  { 0, 0, true,  false, false, false, false },   // Offset 1: R: CAN_Error_1
-  // Offset 2: R: Maximum bytes not counting cmd bytes
-  { CAN_MAX_TXFR, 0, true,  false, false, false, false }
+static uint16_t can_cache[CAN_HIGH_ADDR-CAN_BASE_ADDR+1] = {
+  0, // Offset 0: R: CAN_Error_0
+  0, // Offset 1: R: CAN_Error_1
+  CAN_MAX_TXFR, // Offset 2: R: Maximum bytes not counting cmd bytes
+  0, // Offset 3: R: Requests received (wraps)
+  0, // Offset 4: R: Reply frames transmitted (wraps)
+  0, // Offset 5: R: RX FIFO 0 overruns (frames lost in hardware)
+  0, // Offset 6: R: RX software queue high-water mark
+  CAN_FD_DEFAULT, // Offset 7: RW: FD replies enabled
+  0, // Offset 8: RW: Read list select
+  0, // Offset 9: RW: Selected read list length
+  CAN_LIST_MAX, // Offset 10: R: Free entries W: Append to read list
+  CAN_REPLAY_DEFAULT_MS // Offset 11: RW: Replay window in ms
 };
+static uint16_t can_wvalue[CAN_HIGH_ADDR-CAN_BASE_ADDR+1];
+
+static void can_list_update_cache(void) {
+  int n = can_lists[can_cache[CAN_LIST_SEL_ADDR-CAN_BASE_ADDR]].n;
+  can_cache[CAN_LIST_LEN_ADDR-CAN_BASE_ADDR] = n;
+  can_cache[CAN_LIST_ADDR-CAN_BASE_ADDR] = CAN_LIST_MAX - n;
+}
+
+/**
+ * Handles read list loading immediately, so a block write to
+ * CAN_LIST_ADDR appends every word.
+ */
+static void can_action(void) {
+  uint16_t value;
+  int sel = can_cache[CAN_LIST_SEL_ADDR-CAN_BASE_ADDR];
+  if (subbus_cache_iswritten(&sb_can, CAN_LIST_SEL_ADDR, &value) &&
+      value < CAN_N_LISTS) {
+    can_cache[CAN_LIST_SEL_ADDR-CAN_BASE_ADDR] = sel = value;
+  }
+  if (subbus_cache_iswritten(&sb_can, CAN_LIST_LEN_ADDR, &value) &&
+      value < can_lists[sel].n) {
+    can_lists[sel].n = value;
+  }
+  if (subbus_cache_iswritten(&sb_can, CAN_LIST_ADDR, &value) &&
+      can_lists[sel].n < CAN_LIST_MAX) {
+    can_lists[sel].addrs[can_lists[sel].n++] = value;
+  }
+  can_list_update_cache();
+}
 
 static void poll_can_control() {
-  if (can_cache[0].was_read) {
-    can_cache[0].was_read = false;
-    can_cache[0].cache = 0;
+  if (subbus_cache_was_read(&sb_can, CAN_BASE_ADDR)) {
+    subbus_cache_clear_read(&sb_can, SUBBUS_BIT(0));
+    can_cache[0] = 0;
   }
-  if (can_cache[1].was_read) {
-    can_cache[1].was_read = false;
-    can_cache[1].cache = 0;
+  if (subbus_cache_was_read(&sb_can, CAN_BASE_ADDR+1)) {
+    subbus_cache_clear_read(&sb_can, SUBBUS_BIT(1));
+    can_cache[1] = 0;
+  }
+  { uint16_t value;
+    if (subbus_cache_iswritten(&sb_can, CAN_FD_ADDR, &value)) {
+      subbus_cache_update(&sb_can, CAN_FD_ADDR, value != 0);
+    }
+    if (subbus_cache_iswritten(&sb_can, CAN_REPLAY_ADDR, &value)) {
+      subbus_cache_update(&sb_can, CAN_REPLAY_ADDR, value);
+    }
   }
   if (cur_req.pending) {
-    service_can_request(false);
-  } else {
+    // If blocked, CAN_CTRL_tx_callback() refills the FIFO and marks
+    // us ready once the response is complete.
+    if (!cur_req.tx_blocked) {
+      service_can_request(false);
+      subbus_mark_ready(&sb_can);
+    }
+  } else if (can_req_q_count) {
+    can_req_respond();
+    subbus_mark_ready(&sb_can);
+  } else if (can_stream.active) {
+    can_stream_service();
+  }
+  // Keep reassembling requests while a reply is transmitted, as long
+  // as there is a context that is not waiting for its reply.
+  if (can_req_q_count < CAN_MAX_REQS) {
     struct can_message msg;
-    uint8_t data[64];
     int32_t err;
-    msg.data = data;
-    err = can_control_read(&msg);
+    err = can_rxq_peek(&msg);
     if (err) {
       // can_async_read() returns ERR_NOT_FOUND if no message is waiting
       if (err != ERR_NOT_FOUND) {
         record_can_error(err);
       }
-    } else process_can_request(&msg);
+    } else {
+      // Parsed in place in the queue entry
+      process_can_request(&msg);
+      can_rxq_release();
+      // More frames may be waiting in the RX FIFO
+      subbus_mark_ready(&sb_can);
+    }
   }
 }
 
 subbus_driver_t sb_can = {
   CAN_BASE_ADDR, CAN_HIGH_ADDR, // address range
-  can_cache,
+  can_cache, can_wvalue,
+  SUBBUS_BITS(0, CAN_HIGH_ADDR-CAN_BASE_ADDR), // readable
+  SUBBUS_BIT(CAN_FD_ADDR-CAN_BASE_ADDR) |
+    SUBBUS_BITS(CAN_LIST_SEL_ADDR-CAN_BASE_ADDR,
+                CAN_LIST_ADDR-CAN_BASE_ADDR) |
+    SUBBUS_BIT(CAN_REPLAY_ADDR-CAN_BASE_ADDR), // writable
+  SUBBUS_BITS(CAN_LIST_SEL_ADDR-CAN_BASE_ADDR,
+              CAN_LIST_ADDR-CAN_BASE_ADDR), // dynamic
+  0, 0, // was_read, written
   can_control_init,
   poll_can_control,
-  0, // Dynamic function
+  can_action, // Dynamic function
   false
 };
 
 extern subbus_driver_t sb_can_desc;
 
-static subbus_cache_word_t can_desc_cache[2] = {
-  { 0, 0, true, false, false, false, false },
-  { 0, 0, true, false, false, false, true }
-};
+static uint16_t can_desc_cache[2];
 
 static struct can_desc_t {
   const char *desc;
@@ -493,7 +1482,7 @@ static void can_desc_init(void) {
 }
 
 static void can_desc_action(void) {
-  if (can_desc_cache[1].was_read) {
+  if (subbus_cache_was_read(&sb_can_desc, SUBBUS_DESC_FIFO_ADDR)) {
     can_desc.cp += 2;
     if (can_desc.cp >= can_desc.nc) {
       can_desc.cp = 0;
@@ -507,5 +1496,26 @@ static void can_desc_action(void) {
 
 subbus_driver_t sb_can_desc = {
   SUBBUS_DESC_FIFO_SIZE_ADDR, SUBBUS_DESC_FIFO_ADDR,
-  can_desc_cache, can_desc_init, 0, can_desc_action,
+  can_desc_cache, 0,
+  SUBBUS_BITS(0,1), 0, SUBBUS_BIT(1), 0, 0,
+  can_desc_init, 0, can_desc_action,
+  false };
+
+/**
+ * Reading the maximum latency starts a new maximum
+ */
+static void can_ts_action(void) {
+  if (subbus_cache_was_read(&sb_can_ts, CAN_TS_HIGH_ADDR)) {
+    subbus_cache_clear_read(&sb_can_ts, SUBBUS_BIT(2));
+    CRITICAL_SECTION_ENTER()
+    can_ts_cache[2] = 0;
+    CRITICAL_SECTION_LEAVE()
+  }
+}
+
+subbus_driver_t sb_can_ts = {
+  CAN_TS_BASE_ADDR, CAN_TS_HIGH_ADDR,
+  can_ts_cache, 0,
+  SUBBUS_BITS(0,2), 0, SUBBUS_BIT(2), 0, 0,
+  0, 0, can_ts_action,
   false };
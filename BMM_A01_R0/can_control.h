@@ -8,7 +8,39 @@
 #include "serial_num.h"
 
 #define CAN_BASE_ADDR 0x34
-#define CAN_HIGH_ADDR 0x36
+#define CAN_HIGH_ADDR 0x3F
+/** Request timing registers, in counts of the CAN timestamp counter
+ *  (CONF_CAN1_TSCC_TCP CAN bit times). See can_control_timestamp().
+ *  0x31 R: Reception time of the last request answered
+ *  0x32 R: Latency of that request, from reception to reply queued
+ *  0x33 R: Maximum latency since this register was last read
+ */
+#define CAN_TS_BASE_ADDR 0x31
+#define CAN_TS_HIGH_ADDR 0x33
+/** R/W: Non-zero to send replies in 64-byte CAN FD frames */
+#define CAN_FD_ADDR 0x3B
+/** R/W: Selects the read list for CAN_LIST_LEN_ADDR and CAN_LIST_ADDR */
+#define CAN_LIST_SEL_ADDR 0x3C
+/** R/W: Length of the selected read list. Writes may only shorten it,
+ *  so write 0 before loading a new list.
+ */
+#define CAN_LIST_LEN_ADDR 0x3D
+/** W: Appends an address to the selected read list
+ *  R: Number of addresses that can still be appended
+ */
+#define CAN_LIST_ADDR 0x3E
+#define CAN_N_LISTS 4
+#define CAN_LIST_MAX 32
+/** R/W: Window in milliseconds during which an identical retried
+ *  request is answered from the replay cache. 0 disables replay.
+ *  Replay is off by default, since a host that repeats a request on
+ *  the same REQID within the window expects fresh data, e.g. when
+ *  polling quickly or draining a FIFO register with RD_CNT_NOINC.
+ */
+#define CAN_REPLAY_ADDR 0x3F
+#ifndef CAN_REPLAY_DEFAULT_MS
+#define CAN_REPLAY_DEFAULT_MS 0
+#endif
 
 #define CAN_ID_BOARD_MASK 0x780
 #define CAN_ID_BOARD(x) (((x)<<7)&CAN_ID_BOARD_MASK)
@@ -20,6 +52,29 @@
 #define CAN_REQUEST_ID(bd,req) (CAN_ID_BOARD(bd)|(req&CAN_ID_REQID))
 #define CAN_REQUEST_MATCH(id,bd) \
     ((id & (CAN_ID_BOARD_MASK|CAN_ID_REPLY_BIT)) == CAN_ID_BOARD(bd))
+/** Requests to board 0 are accepted by every board. Broadcast writes
+ *  are performed without a reply, and other broadcast commands are
+ *  ignored, since replies from several boards would collide.
+ */
+#define CAN_BROADCAST_ID 0
+/** REQID of unsolicited interrupt notifications. Hosts should not use
+ *  it for requests. The notification payload is the 2-byte INTA value.
+ */
+#define CAN_INTR_REQID CAN_ID_REQID_MASK
+/** Default REQID of periodic telemetry frames. See publish.c */
+#define CAN_PUB_REQID (CAN_ID_REQID_MASK-1)
+/** Default REQID of change-of-value reports. See cov.c */
+#define CAN_COV_REQID (CAN_ID_REQID_MASK-2)
+/** Emergency command frames use the reply range of board 0, which is
+ *  otherwise unused since broadcasts are never answered. These are the
+ *  lowest IDs on the bus, so they win arbitration over all other
+ *  traffic. The REQID bits select the target board, 0 for all boards.
+ *  data[0] is a command code as written to CMD_BASE_ADDR; only the
+ *  FAULT_LED and SHDN_N commands are honored (see cmd_emergency()).
+ *  The frames are routed to RX FIFO 1 and executed from the interrupt
+ *  handler. No reply is sent.
+ */
+#define CAN_EMERG_ID(bd) (CAN_ID_BOARD(CAN_BROADCAST_ID)|CAN_ID_REPLY_BIT|CAN_ID_REQID(bd))
 
 #define CAN_CMD_CODE_MASK 0x7
 #define CAN_CMD_CODE(x) ((x) & CAN_CMD_CODE_MASK)
@@ -30,12 +85,67 @@
 #define CAN_CMD_CODE_WR_INC 0x4
 #define CAN_CMD_CODE_WR_NOINC 0x5
 #define CAN_CMD_CODE_ERROR 0x6
+/** Extended commands. The first payload byte is one of the CAN_EXT_*
+ *  operation codes below, followed by the operation's arguments.
+ */
+#define CAN_CMD_CODE_EXT 0x7
 #define CAN_CMD_SEQ_MASK 0xF8 // Can report up to 112 words without wrapping
 #define CAN_SEQ_CMD(s) (((s)<<3)&CAN_CMD_SEQ_MASK)
 #define CAN_CMD_SEQ(c) (((c)&CAN_CMD_SEQ_MASK)>>3)
 
 #define CAN_MAX_TXFR 224
 
+/** Streaming read. Arguments: address, flags (bit 0: increment),
+ *  window (frames, 1-CAN_STREAM_MAX_WINDOW, 0 cancels the stream) and
+ *  a 16-bit word count, LSB first (0 for unlimited). The stream is
+ *  sent as frames of CAN_CMD_CODE_EXT|CAN_SEQ_CMD(frame number) followed
+ *  by data bytes, without any other reply.
+ */
+#define CAN_EXT_STREAM 0x00
+/** Acknowledge a stream. Argument: 16-bit count of frames received in
+ *  order. Opens the window. No reply.
+ */
+#define CAN_EXT_STREAM_ACK 0x01
+/** As CAN_EXT_STREAM_ACK, but also resends everything after the frames
+ *  acknowledged, e.g. after a frame was lost. No reply.
+ */
+#define CAN_EXT_STREAM_RESUME 0x02
+#define CAN_STREAM_MAX_WINDOW 16
+/** Read a stored read list. Argument: list index. The reply is the
+ *  same as a CAN_CMD_CODE_RD of the list's addresses.
+ */
+#define CAN_EXT_RD_LIST 0x03
+/** Read-modify-write. Arguments: 16-bit AND, OR and XOR masks, then
+ *  one or more addresses. Each register is read and written back as
+ *  ((old & AND) | OR) ^ XOR before any other firmware activity, so
+ *  set bits with AND=0xFFFF and OR=bits, clear them with AND=~bits,
+ *  toggle them with AND=0xFFFF and XOR=bits. The reply holds the old
+ *  value of each register and the new value written to it, which a
+ *  driver may store differently, e.g. when some bits are read-only.
+ *  Processing stops at the first NACK. An RMW is not idempotent, so a
+ *  host that retries one after a lost reply must enable replay with
+ *  CAN_REPLAY_ADDR first, or a toggle is applied twice.
+ */
+#define CAN_EXT_RMW 0x04
+/** Maximum frame payloads. FD frames are only sent to hosts that
+ *  enable them via CAN_FD_ADDR or send FD requests themselves.
+ */
+#define CAN_CLASSIC_DLEN 8
+#define CAN_FD_DLEN 64
+#ifndef CAN_FD_DEFAULT
+#define CAN_FD_DEFAULT 0
+#endif
+/** Dedicated TX buffers available to can_control_stage(). Must not
+ *  exceed CONF_CAN1_TXBC_NDTB.
+ */
+#define CAN_STAGE_BUFFERS 4
+/** Set to answer single-frame CAN_CMD_CODE_RD requests for plain cache
+ *  words directly from the receive interrupt. See can_isr_read().
+ */
+#ifndef CAN_ISR_READS
+#define CAN_ISR_READS 1
+#endif
+
 #define CAN_ERR_BAD_REQ_RESP 1
 #define CAN_ERR_NACK 2
 #define CAN_ERR_OTHER 3
@@ -48,7 +158,12 @@ extern bool can_tx_completed;
 
 int32_t can_control_read(struct can_message *msg);
 int32_t can_control_write(uint16_t ID, uint8_t *data, int nb);
+bool can_control_fd(void);
+uint16_t can_control_timestamp(void);
+int32_t can_control_stage(uint8_t index, uint16_t ID, uint8_t *data, int nb);
+void can_control_set_remote(uint16_t ID, uint8_t mask);
 extern subbus_driver_t sb_can;
 extern subbus_driver_t sb_can_desc;
+extern subbus_driver_t sb_can_ts;
 
 #endif
@@ -10,27 +10,54 @@ static void update_status(uint16_t *status, uint8_t pin, uint16_t bit) {
   }
 }
 
+#define CMD_STATUS_ALRT 0x10
+
+static void cmd_execute(uint16_t cmd) {
+  switch (cmd) {
+    case 0: gpio_set_pin_level(STATUS_LED, false); break;
+    case 1: gpio_set_pin_level(STATUS_LED, true); break;
+    case 2: gpio_set_pin_level(FAULT_LED, false); break;
+    case 3: gpio_set_pin_level(FAULT_LED, true); break;
+    case 4: gpio_set_pin_level(SHDN_N, false); break;
+    case 5: gpio_set_pin_level(SHDN_N, true); break;
+    default:
+      break;
+  }
+}
+
+/**
+ * Executes a command from interrupt context, bypassing the subbus
+ * cache. Called from the CAN RX FIFO 1 handler for emergency frames
+ * (see CAN_EMERG_ID). Only the FAULT_LED and SHDN_N commands are
+ * accepted. The status word catches up on the next cmd_poll().
+ * @param cmd The command code, as written to CMD_BASE_ADDR
+ * @return true if the command was executed
+ */
+bool cmd_emergency(uint16_t cmd) {
+  if (cmd < 2 || cmd > 5) return false;
+  cmd_execute(cmd);
+  return true;
+}
+
 static void cmd_poll(void) {
+  static uint16_t prev_status = 0;
   uint16_t cmd;
   uint16_t status;
   if (subbus_cache_iswritten(&sb_cmd, CMD_BASE_ADDR, &cmd)) {
-    switch (cmd) {
-      case 0: gpio_set_pin_level(STATUS_LED, false); break;
-      case 1: gpio_set_pin_level(STATUS_LED, true); break;
-      case 2: gpio_set_pin_level(FAULT_LED, false); break;
-      case 3: gpio_set_pin_level(FAULT_LED, true); break;
-      case 4: gpio_set_pin_level(SHDN_N, false); break;
-      case 5: gpio_set_pin_level(SHDN_N, true); break;
-      default:
-        break;
-    }
+    cmd_execute(cmd);
   }
   status = 0;
   update_status(&status, STATUS_LED, 0x01);
   update_status(&status, FAULT_LED, 0x02);
   update_status(&status, SHDN_N, 0x04);
   update_status(&status, VDD2SENSE, 0x08);
-  update_status(&status, ALRT, 0x10);
+  update_status(&status, ALRT, CMD_STATUS_ALRT);
+#if SUBBUS_INTERRUPTS
+  if (status & ~prev_status & CMD_STATUS_ALRT) {
+    subbus_intr_raise(CMD_BASE_ADDR);
+  }
+#endif
+  prev_status = status;
   subbus_cache_update(&sb_cmd, CMD_BASE_ADDR, status);
 }
 
@@ -48,15 +75,18 @@ static void cmd_reset(void) {
  * 0x19 R: ADC_U2_T
  * 0x1A R: ADC_U3_T
  */
-static subbus_cache_word_t cmd_cache[CMD_HIGH_ADDR-CMD_BASE_ADDR+1] = {
-  { 0, 0, true,  false, true, false, false } // Offset 0: R: ADC Flow 0
-};
+static uint16_t cmd_cache[CMD_HIGH_ADDR-CMD_BASE_ADDR+1]; // Offset 0: R: Status W: Command
+static uint16_t cmd_wvalue[CMD_HIGH_ADDR-CMD_BASE_ADDR+1];
 
 subbus_driver_t sb_cmd = {
   CMD_BASE_ADDR, CMD_HIGH_ADDR, // address range
-  cmd_cache,
+  cmd_cache, cmd_wvalue,
+  SUBBUS_BIT(0), SUBBUS_BIT(0), // readable, writable
+  0, 0, 0, // dynamic, was_read, written
   cmd_reset,
   cmd_poll,
   0, // dynamic driver
-  false
+  false,
+  0, // read_block
+  true // periodic: status pins have no interrupt
 };
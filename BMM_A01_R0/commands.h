@@ -8,5 +8,6 @@
 #define CMD_HIGH_ADDR 0x30
 
 extern subbus_driver_t sb_cmd;
+bool cmd_emergency(uint16_t cmd);
 
 #endif
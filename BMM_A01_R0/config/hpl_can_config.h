@@ -13,14 +13,14 @@
 // <i> Enable CAN FD operation
 // <id> can_cccr_fdoe
 #ifndef CONF_CAN1_CCCR_FDOE
-#define CONF_CAN1_CCCR_FDOE 0
+#define CONF_CAN1_CCCR_FDOE 1
 #endif
 
 // <q> Bit Rate Switch Enable
 // <i> Bit Rate Switch Enable
 // <id> can_cccr_brse
 #ifndef CONF_CAN1_CCCR_BRSE
-#define CONF_CAN1_CCCR_BRSE 0
+#define CONF_CAN1_CCCR_BRSE 1
 #endif
 
 // <q> Run In Standby
@@ -136,7 +136,7 @@
 // <i> Number of Rx FIFO 0 element
 // <id> can_rxf0c_f0s
 #ifndef CONF_CAN1_RXF0C_F0S
-#define CONF_CAN1_RXF0C_F0S 2
+#define CONF_CAN1_RXF0C_F0S 16
 #endif
 
 // <o> Data Field Size
@@ -151,7 +151,7 @@
 // <7=> 64 byte data field.
 // <id> can_rxesc_f0ds
 #ifndef CONF_CAN1_RXESC_F0DS
-#define CONF_CAN1_RXESC_F0DS 0
+#define CONF_CAN1_RXESC_F0DS 7
 #endif
 
 /* Bytes size for CAN FIFO 0 element, plus 8 bytes for R0,R1 */
@@ -161,13 +161,53 @@
 
 // </h>
 
+// <h> RX FIFO 1 Configuration
+
+// <o> Size <0-64>
+// <i> Number of Rx FIFO 1 elements. Only frames matching a filter
+// <i> set with _can_async_set_priority_filter() are stored here.
+// <id> can_rxf1c_f1s
+#ifndef CONF_CAN1_RXF1C_F1S
+#define CONF_CAN1_RXF1C_F1S 4
+#endif
+
+// <o> Data Field Size
+// <i> Rx FIFO 1 Data Field Size
+// <0=> 8 byte data field.
+// <1=> 12 byte data field.
+// <2=> 16 byte data field.
+// <3=> 20 byte data field.
+// <4=> 24 byte data field.
+// <5=> 32 byte data field.
+// <6=> 48 byte data field.
+// <7=> 64 byte data field.
+// <id> can_rxesc_f1ds
+#ifndef CONF_CAN1_RXESC_F1DS
+#define CONF_CAN1_RXESC_F1DS 0
+#endif
+
+/* Bytes size for CAN FIFO 1 element, plus 8 bytes for R0,R1 */
+#undef CONF_CAN1_F1DS
+#define CONF_CAN1_F1DS                                                                                                 \
+	((CONF_CAN1_RXESC_F1DS < 5) ? ((CONF_CAN1_RXESC_F1DS << 2) + 16) : (40 + ((CONF_CAN1_RXESC_F1DS % 5) << 4)))
+
+// </h>
+
 // <h> TX FIFO Configuration
 
+// <o> Number of Dedicated Transmit Buffers <0-32>
+// <i> Tx Buffers outside the Tx FIFO. They precede it in message RAM
+// <i> and are loaded and released individually.
+// <id> can_txbc_ndtb
+#ifndef CONF_CAN1_TXBC_NDTB
+#define CONF_CAN1_TXBC_NDTB 4
+#endif
+
 // <o> Transmit FIFO Size <0-32>
 // <i> Number of Tx Buffers used for Tx FIFO
 // <id> can_txbc_tfqs
 #ifndef CONF_CAN1_TXBC_TFQS
-#define CONF_CAN1_TXBC_TFQS 2
+#define CONF_CAN1_TXBC_TFQS 8
 #endif
 
 // <o> Tx Buffer Data Field Size
@@ -182,7 +222,7 @@
 // <7=> 64 byte data field.
 // <id> can_txesc_tbds
 #ifndef CONF_CAN1_TXESC_TBDS
-#define CONF_CAN1_TXESC_TBDS 0
+#define CONF_CAN1_TXESC_TBDS 7
 #endif
 
 /* Bytes size for CAN Transmit Buffer element, plus 8 bytes for R0,R1 */
@@ -256,7 +296,7 @@
 // <i> Number of standard Message ID filter elements
 // <id> can_sidfc_lss
 #ifndef CONF_CAN1_SIDFC_LSS
-#define CONF_CAN1_SIDFC_LSS 2
+#define CONF_CAN1_SIDFC_LSS 4
 #endif
 
 // <o> Number of Extended Message ID filter elements <0-128>
@@ -276,6 +316,14 @@
 #define CONF_CAN1_XIDAM_EIDM 0x0
 #endif
 
+// <o> Timestamp Counter Prescaler <1-16>
+// <i> The internal timestamp counter advances once every this many CAN
+// <i> bit times. Received frames are stamped with its value.
+// <id> can_tscc_tcp
+#ifndef CONF_CAN1_TSCC_TCP
+#define CONF_CAN1_TSCC_TCP 1
+#endif
+
 // </h>
 
 // <h> Interrupt Configuration
@@ -312,7 +360,7 @@
 // <i> Indicates whether to not disable CAN data overrun interrupt
 // <id> can_ie_do
 #ifndef CONF_CAN1_IE_DO
-#define CONF_CAN1_IE_DO 0
+#define CONF_CAN1_IE_DO 1
 #endif
 
 // </h>
@@ -344,8 +392,12 @@
 	    | CAN_RXF0C_F0S(CONF_CAN1_RXF0C_F0S)
 #endif
 
+#ifndef CONF_CAN1_RXF1C_REG
+#define CONF_CAN1_RXF1C_REG CAN_RXF1C_F1S(CONF_CAN1_RXF1C_F1S)
+#endif
+
 #ifndef CONF_CAN1_RXESC_REG
-#define CONF_CAN1_RXESC_REG CAN_RXESC_F0DS(CONF_CAN1_RXESC_F0DS)
+#define CONF_CAN1_RXESC_REG (CAN_RXESC_F0DS(CONF_CAN1_RXESC_F0DS) | CAN_RXESC_F1DS(CONF_CAN1_RXESC_F1DS))
 #endif
 
 #ifndef CONF_CAN1_TXESC_REG
@@ -353,7 +405,7 @@
 #endif
 
 #ifndef CONF_CAN1_TXBC_REG
-#define CONF_CAN1_TXBC_REG CAN_TXBC_TFQS(CONF_CAN1_TXBC_TFQS)
+#define CONF_CAN1_TXBC_REG (CAN_TXBC_NDTB(CONF_CAN1_TXBC_NDTB) | CAN_TXBC_TFQS(CONF_CAN1_TXBC_TFQS))
 #endif
 
 #ifndef CONF_CAN1_TXEFC_REG
@@ -378,6 +430,10 @@
 #define CONF_CAN1_XIDAM_REG CAN_XIDAM_EIDM(CONF_CAN1_XIDAM_EIDM)
 #endif
 
+#ifndef CONF_CAN1_TSCC_REG
+#define CONF_CAN1_TSCC_REG (CAN_TSCC_TCP(CONF_CAN1_TSCC_TCP - 1) | CAN_TSCC_TSS(1))
+#endif
+
 #ifndef CONF_CAN0_IE_REG
 #define CONF_CAN0_IE_REG                                                                                               \
 	(CONF_CAN1_IE_EW << CAN_IR_EW_Pos) | (CONF_CAN1_IE_EA << CAN_IR_EP_Pos) | (CONF_CAN1_IE_EP << CAN_IR_EP_Pos)       \
@@ -59,6 +59,9 @@ static void hex_out(uint16_t data) {
   uart_send_char(hex[data&0xF]);
 }
 
+/** Maximum number of words read_multi() reads with one subbus_read_block() */
+#define READ_MULTI_BLOCK 16
+
 /**
  * Syntax: M<count>#<addr_range>[,<addr_range>...]
  *   <addr_range>
@@ -78,7 +81,8 @@ static void hex_out(uint16_t data) {
  */
 static void read_multi(uint8_t *cmd) {
   uint16_t addr, start, incr, end, count, rep;
-  uint16_t result;
+  uint16_t result, i;
+  uint16_t results[READ_MULTI_BLOCK];
   ++cmd;
   if ( read_hex( &cmd, &count ) || count > 500 || *cmd != '#' ) {
     SendErrorMsg("3");
@@ -148,23 +152,38 @@ static void read_multi(uint8_t *cmd) {
       rep = 1;
       end = addr;
     }
-    for ( start = addr; addr >= start && addr <= end && rep > 0; addr += incr, --rep, --count ) {
+    for ( start = addr; addr >= start && addr <= end && rep > 0; ) {
+      uint16_t nw, nr;
       if ( count == 0 ) {
         SendErrorMsg("3");
         return;
       }
+      nw = rep < count ? rep : count;
+      if (incr > 1) {
+        nw = 1;
+      } else if (incr == 1 && nw > end - addr + 1) {
+        nw = end - addr + 1;
+      }
+      if (nw > READ_MULTI_BLOCK) {
+        nw = READ_MULTI_BLOCK;
+      }
 #if USE_SUBBUS
-      if ( subbus_read( addr, &result ) ) {
+      nr = subbus_read_block(addr, nw, incr != 0, results);
+      for (i = 0; i < nr; ++i) {
         uart_send_char('M');
-        hex_out(result);
-      } else {
-        uart_send_char('m');
-        uart_send_char('0');
+        hex_out(results[i]);
       }
 #else
-      uart_send_char('m');
-      uart_send_char('0');
+      nr = 0;
 #endif
+      if (nr < nw) {
+        uart_send_char('m');
+        uart_send_char('0');
+        ++nr;
+      }
+      addr += incr * nr;
+      rep -= nr;
+      count -= nr;
     }
     if (*cmd == '\n' || *cmd == '\r') {
       SendMsg("");
@@ -176,6 +195,21 @@ static void read_multi(uint8_t *cmd) {
   }
 }
 
+#if SUBBUS_INTERRUPTS
+/**
+ * Tells a serial host which interrupts are pending with an unsolicited
+ * "I<inta>" line. Registered when the host first attaches an interrupt
+ * with the 'i' command. Lines are only written between command
+ * responses, since both run from the main loop.
+ * @param inta The current INTA value
+ * @return true, as the UART output blocks until sent
+ */
+static bool serial_intr_notify(uint16_t inta) {
+  SendCodeVal('I', inta);
+  return true;
+}
+#endif
+
 static void parse_command(uint8_t *cmd) {
   int nargs = 0;
   uint8_t cmd_code;
@@ -287,9 +321,10 @@ static void parse_command(uint8_t *cmd) {
       break;
     case 'i':
 #if SUBBUS_INTERRUPTS
-      if ( intr_attach(arg1, arg2))
+      if ( intr_attach(arg1, arg2)) {
+        subbus_intr_add_notify(serial_intr_notify);
         SendCodeVal('i', arg1);
-      else
+      } else
 #endif
         SendErrorMsg("4");
       break;
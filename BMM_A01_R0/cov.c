@@ -0,0 +1,174 @@
+/** @file cov.c
+ * Change-of-value reporting. Monitored registers are reported over CAN
+ * when subbus_cache_update() moves them more than their deadband from
+ * the last value reported, and at least once per heartbeat interval.
+ * Each report frame carries up to 2 (21 in CAN FD mode) 3-byte entries:
+ * the register address followed by its value, LSB first.
+ *
+ * 0x60 RW: Heartbeat in milliseconds. Registers are reported at least
+ *   this often even if unchanged. 0 reports on change only.
+ * 0x61 RW: CAN ID of report frames. Defaults to the board's
+ *   CAN_COV_REQID reply ID.
+ * 0x62 RW: Number of monitored registers, up to COV_MAX_ADDRS.
+ *   Writing the count or the list reports every monitored register
+ *   once.
+ * 0x63-0x6E RW: Address/deadband pairs. A change larger than the
+ *   deadband is reported, so deadband 0 reports any change. Reports
+ *   carry 1-byte addresses, so writes of addresses above 0xFF are
+ *   ignored.
+ * 0x6F R:  Report frames sent (wraps)
+ */
+#include <string.h>
+#include "cov.h"
+#include "can_control.h"
+#include "tick.h"
+
+#define COV_HEARTBEAT 0
+#define COV_ID 1
+#define COV_COUNT 2
+#define COV_LIST 3
+#define COV_FRAMES 15
+#define COV_ENTRY_SIZE 3
+#define COV_MAX_ADDR 0xFF
+
+static uint16_t cov_cache[COV_HIGH_ADDR-COV_BASE_ADDR+1];
+static uint16_t cov_wvalue[COV_HIGH_ADDR-COV_BASE_ADDR+1];
+
+static struct {
+  uint16_t value;    // Latest value stored by subbus_cache_update()
+  uint16_t reported; // Last value sent
+  uint32_t sent_tick;
+  bool pending;
+} cov_entries[COV_MAX_ADDRS];
+
+#define COV_ADDR(i) cov_cache[COV_LIST+2*(i)]
+#define COV_DEADBAND(i) cov_cache[COV_LIST+2*(i)+1]
+
+/**
+ * Registered with subbus_cache_set_monitor()
+ */
+static void cov_monitor(uint16_t addr, uint16_t data) {
+  int i;
+  for (i = 0; i < cov_cache[COV_COUNT]; ++i) {
+    if (COV_ADDR(i) == addr) {
+      uint16_t reported = cov_entries[i].reported;
+      uint16_t delta = data > reported ? data - reported : reported - data;
+      cov_entries[i].value = data;
+      if (delta > COV_DEADBAND(i) && !cov_entries[i].pending) {
+        cov_entries[i].pending = true;
+        subbus_mark_ready(&sb_cov);
+      }
+    }
+  }
+}
+
+/**
+ * Marks every monitored register for reporting, starting from its
+ * current cached value. subbus_peek() is used so that reconfiguring
+ * the list has no read side effects on the monitored registers.
+ */
+static void cov_report_all(void) {
+  int i;
+  for (i = 0; i < cov_cache[COV_COUNT]; ++i) {
+    subbus_peek(COV_ADDR(i), &cov_entries[i].value);
+    cov_entries[i].pending = true;
+  }
+  subbus_mark_ready(&sb_cov);
+}
+
+static void cov_reset(void) {
+  memset(cov_cache, 0, sizeof(cov_cache));
+  memset(cov_entries, 0, sizeof(cov_entries));
+  cov_cache[COV_ID] = CAN_ID_BOARD(CAN_BOARD_ID) | CAN_ID_REPLY_BIT |
+                      CAN_COV_REQID;
+  sb_cov.periodic = false;
+  subbus_cache_set_monitor(cov_monitor);
+}
+
+/**
+ * Sends pending reports, packing as many as fit in each frame. If the
+ * TX FIFO is full, the rest stay pending and are retried on the next
+ * tick.
+ */
+static void cov_poll(void) {
+  int max_entries =
+    (can_control_fd() ? CAN_FD_DLEN : CAN_CLASSIC_DLEN)/COV_ENTRY_SIZE;
+  uint32_t now = tick_now();
+  uint16_t heartbeat = cov_cache[COV_HEARTBEAT];
+  int i = 0;
+
+  if (heartbeat) {
+    for (i = 0; i < cov_cache[COV_COUNT]; ++i) {
+      if (now - cov_entries[i].sent_tick >= heartbeat) {
+        cov_entries[i].pending = true;
+      }
+    }
+  }
+  i = 0;
+  while (i < cov_cache[COV_COUNT]) {
+    uint8_t data[CAN_FD_DLEN];
+    int entries[COV_MAX_ADDRS];
+    int j, ne = 0, nb = 0;
+    for (; i < cov_cache[COV_COUNT] && ne < max_entries; ++i) {
+      if (cov_entries[i].pending) {
+        data[nb++] = COV_ADDR(i);
+        data[nb++] = cov_entries[i].value & 0xFF;
+        data[nb++] = (cov_entries[i].value >> 8) & 0xFF;
+        entries[ne++] = i;
+      }
+    }
+    if (ne == 0) break;
+    if (can_control_write(cov_cache[COV_ID], data, nb) != ERR_NONE) {
+      return;
+    }
+    ++cov_cache[COV_FRAMES];
+    for (j = 0; j < ne; ++j) {
+      int k = entries[j];
+      cov_entries[k].reported = cov_entries[k].value;
+      cov_entries[k].sent_tick = now;
+      cov_entries[k].pending = false;
+    }
+  }
+}
+
+static void cov_action(void) {
+  uint16_t value;
+  bool reconfigured = false;
+  int i;
+  if (subbus_cache_iswritten(&sb_cov, COV_BASE_ADDR+COV_HEARTBEAT, &value)) {
+    cov_cache[COV_HEARTBEAT] = value;
+  }
+  if (subbus_cache_iswritten(&sb_cov, COV_BASE_ADDR+COV_ID, &value)) {
+    cov_cache[COV_ID] = value & 0x7FF;
+  }
+  for (i = COV_LIST; i < COV_FRAMES; ++i) {
+    if (subbus_cache_iswritten(&sb_cov, COV_BASE_ADDR+i, &value)) {
+      if ((i-COV_LIST) % 2 == 0 && value > COV_MAX_ADDR) continue;
+      cov_cache[i] = value;
+      reconfigured = true;
+    }
+  }
+  if (subbus_cache_iswritten(&sb_cov, COV_BASE_ADDR+COV_COUNT, &value)) {
+    cov_cache[COV_COUNT] = value > COV_MAX_ADDRS ? COV_MAX_ADDRS : value;
+    reconfigured = true;
+  }
+  if (reconfigured) {
+    cov_report_all();
+  }
+  // Pending reports are retried on the tick when the TX FIFO is full,
+  // and the heartbeat needs it too.
+  sb_cov.periodic = cov_cache[COV_COUNT] != 0;
+}
+
+subbus_driver_t sb_cov = {
+  COV_BASE_ADDR, COV_HIGH_ADDR, // address range
+  cov_cache, cov_wvalue,
+  SUBBUS_BITS(COV_HEARTBEAT, COV_FRAMES), // readable
+  SUBBUS_BITS(COV_HEARTBEAT, COV_FRAMES-1), // writable
+  SUBBUS_BITS(COV_HEARTBEAT, COV_FRAMES-1), // dynamic
+  0, 0, // was_read, written
+  cov_reset,
+  cov_poll,
+  cov_action,
+  false
+};
@@ -0,0 +1,13 @@
+#ifndef COV_H_INCLUDED
+#define COV_H_INCLUDED
+#include <stdint.h>
+#include "subbus.h"
+
+#define COV_BASE_ADDR 0x60
+#define COV_HIGH_ADDR 0x6F
+/** Maximum number of monitored registers */
+#define COV_MAX_ADDRS 6
+
+extern subbus_driver_t sb_cov;
+
+#endif
@@ -65,6 +65,7 @@ typedef void (*can_cb_t)(struct can_async_descriptor *const descr);
 struct can_callbacks {
 	can_cb_t tx_done;
 	can_cb_t rx_done;
+	can_cb_t rx1_done;
 	void (*irq_handler)(struct can_async_descriptor *const descr, enum can_async_interrupt_type type);
 };
 
@@ -131,6 +132,16 @@ int32_t can_async_disable(struct can_async_descriptor *const descr);
  */
 int32_t can_async_read(struct can_async_descriptor *const descr, struct can_message *msg);
 
+/**
+ * \brief Read a CAN message from Rx FIFO 1
+ *
+ * \param[in] descr The CAN descriptor to read message.
+ * \param[in] msg   The CAN message to read to.
+ *
+ * \return The status of read message.
+ */
+int32_t can_async_read_fifo1(struct can_async_descriptor *const descr, struct can_message *msg);
+
 /**
  * \brief Write a CAN message
  *
@@ -141,6 +152,60 @@ int32_t can_async_read(struct can_async_descriptor *const descr, struct can_mess
  */
 int32_t can_async_write(struct can_async_descriptor *const descr, struct can_message *msg);
 
+/**
+ * \brief Get the data field of the next free TX FIFO element
+ *
+ * Lets a frame payload be built in place instead of being copied by
+ * can_async_write(). Send it with can_async_tx_commit().
+ *
+ * \param[in] descr The CAN descriptor.
+ *
+ * \return Pointer to the data field, or NULL if the TX FIFO is full.
+ */
+uint8_t *can_async_tx_buffer(struct can_async_descriptor *const descr);
+
+/**
+ * \brief Send a CAN message built with can_async_tx_buffer()
+ *
+ * \param[in] descr The CAN descriptor to write message.
+ * \param[in] msg   The CAN message ID, format and length. msg->data
+ *                  is not used.
+ *
+ * \return The status of write message.
+ */
+int32_t can_async_tx_commit(struct can_async_descriptor *const descr, struct can_message *msg);
+
+/**
+ * \brief Load a dedicated TX buffer without requesting transmission
+ *
+ * \param[in] descr The CAN descriptor.
+ * \param[in] index The dedicated TX buffer, below CONF_CANn_TXBC_NDTB.
+ * \param[in] msg   The CAN message to load.
+ *
+ * \return ERR_BUSY if the buffer is still pending transmission.
+ */
+int32_t can_async_set_tx_buffer(struct can_async_descriptor *const descr, uint8_t index, struct can_message *msg);
+
+/**
+ * \brief Request transmission of dedicated TX buffers
+ *
+ * Safe to call from interrupt context. The frames go out with no
+ * further software formatting.
+ *
+ * \param[in] descr The CAN descriptor.
+ * \param[in] mask  Bit n requests transmission of dedicated buffer n.
+ */
+void can_async_send_tx_buffers(struct can_async_descriptor *const descr, uint32_t mask);
+
+/**
+ * \brief Read the timestamp counter
+ *
+ * \param[in] descr The CAN descriptor.
+ *
+ * \return The counter value, the same timebase as can_message.timestamp
+ */
+uint16_t can_async_get_timestamp(struct can_async_descriptor *const descr);
+
 /**
  * \brief Register CAN callback function to interrupt
  *
@@ -203,6 +268,22 @@ int32_t can_async_set_mode(struct can_async_descriptor *const descr, enum can_mo
 int32_t can_async_set_filter(struct can_async_descriptor *const descr, uint8_t index, enum can_format fmt,
                              struct can_filter *filter);
 
+/**
+ * \brief Set CAN Filter storing matches in Rx FIFO 1
+ *
+ * Matching frames are delivered through the CAN_ASYNC_RX1_CB callback
+ * and read with can_async_read_fifo1().
+ *
+ * \param[in] descr The CAN descriptor pointer
+ * \param[in] index   Index of Filter list
+ * \param[in] fmt     CAN Indentify Type
+ * \param[in] filter  CAN Filter struct, NULL for clear filter
+ *
+ * \return Status of the operation.
+ */
+int32_t can_async_set_priority_filter(struct can_async_descriptor *const descr, uint8_t index, enum can_format fmt,
+                                      struct can_filter *filter);
+
 /**
  * \brief Retrieve the current driver version
  *
@@ -96,6 +96,7 @@ struct can_message {
 	uint8_t *       data; /* Pointer to Message Data */
 	uint8_t         len;  /* Message Length */
 	enum can_format fmt;  /* Identifier format, CAN_STD, CAN_EXT */
+	uint16_t        timestamp; /* Timestamp counter value at reception */
 };
 
 /**
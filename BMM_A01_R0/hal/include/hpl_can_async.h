@@ -62,7 +62,8 @@ struct _can_async_device;
 enum can_async_callback_type {
 	CAN_ASYNC_RX_CB, /*!< A new message arrived */
 	CAN_ASYNC_TX_CB, /*!< A message transmitted */
-	CAN_ASYNC_IRQ_CB /*!< Message error of some kind on the CAN bus IRQ */
+	CAN_ASYNC_IRQ_CB, /*!< Message error of some kind on the CAN bus IRQ */
+	CAN_ASYNC_RX1_CB  /*!< A new message arrived in Rx FIFO 1 */
 };
 
 enum can_async_interrupt_type {
@@ -100,6 +101,7 @@ enum can_async_interrupt_type {
 struct _can_async_callback {
 	void (*tx_done)(struct _can_async_device *dev);
 	void (*rx_done)(struct _can_async_device *dev);
+	void (*rx1_done)(struct _can_async_device *dev);
 	void (*irq_handler)(struct _can_async_device *dev, enum can_async_interrupt_type type);
 };
 
@@ -168,6 +170,16 @@ int32_t _can_async_disable(struct _can_async_device *const dev);
  */
 int32_t _can_async_read(struct _can_async_device *const dev, struct can_message *msg);
 
+/**
+ * \brief Read a CAN message from Rx FIFO 1
+ *
+ * \param[in] dev   The CAN device descriptor to read message.
+ * \param[in] msg   The CAN message to read to.
+ *
+ * \return The status of read message.
+ */
+int32_t _can_async_read_fifo1(struct _can_async_device *const dev, struct can_message *msg);
+
 /**
  * \brief Write a CAN message
  *
@@ -178,6 +190,57 @@ int32_t _can_async_read(struct _can_async_device *const dev, struct can_message
  */
 int32_t _can_async_write(struct _can_async_device *const dev, struct can_message *msg);
 
+/**
+ * \brief Get the data field of the next free TX FIFO element
+ *
+ * The frame payload can be written there directly and sent with
+ * _can_async_tx_commit().
+ *
+ * \param[in] dev   The CAN device descriptor.
+ *
+ * \return Pointer to the data field, or NULL if the TX FIFO is full.
+ */
+uint8_t *_can_async_tx_buffer(struct _can_async_device *const dev);
+
+/**
+ * \brief Send the frame in the next free TX FIFO element
+ *
+ * \param[in] dev   The CAN device descriptor.
+ * \param[in] msg   The frame ID, format and length. The payload must
+ *                  already be in the buffer from _can_async_tx_buffer().
+ *
+ * \return The status of write message.
+ */
+int32_t _can_async_tx_commit(struct _can_async_device *const dev, struct can_message *msg);
+
+/**
+ * \brief Load a dedicated TX buffer without requesting transmission
+ *
+ * \param[in] dev   The CAN device descriptor.
+ * \param[in] index The dedicated TX buffer, below CONF_CANn_TXBC_NDTB.
+ * \param[in] msg   The CAN message to load.
+ *
+ * \return ERR_BUSY if the buffer is still pending transmission.
+ */
+int32_t _can_async_set_tx_buffer(struct _can_async_device *const dev, uint8_t index, struct can_message *msg);
+
+/**
+ * \brief Request transmission of dedicated TX buffers
+ *
+ * \param[in] dev   The CAN device descriptor.
+ * \param[in] mask  Bit n requests transmission of dedicated buffer n.
+ */
+void _can_async_send_tx_buffers(struct _can_async_device *const dev, uint32_t mask);
+
+/**
+ * \brief Read the timestamp counter
+ *
+ * \param[in] dev   The CAN device descriptor
+ *
+ * \return The counter value, the same timebase as can_message.timestamp
+ */
+uint16_t _can_async_get_timestamp(struct _can_async_device *const dev);
+
 /**
  * \brief Set CAN Interrupt State
  *
@@ -236,6 +299,21 @@ int32_t _can_async_set_mode(struct _can_async_device *const dev, enum can_mode m
 int32_t _can_async_set_filter(struct _can_async_device *const dev, uint8_t index, enum can_format fmt,
                               struct can_filter *filter);
 
+/**
+ * \brief Set a CAN filter storing matches in Rx FIFO 1
+ *
+ * Like _can_async_set_filter(), but matching frames are flagged as high
+ * priority and stored in Rx FIFO 1 instead of Rx FIFO 0.
+ *
+ * \param[in] dev The CAN device descriptor pointer
+ * \param[in] index   Index of Filter list
+ * \param[in] filter  CAN Filter struct, NULL for clear filter
+ *
+ * \return Status of the operation
+ */
+int32_t _can_async_set_priority_filter(struct _can_async_device *const dev, uint8_t index, enum can_format fmt,
+                                       struct can_filter *filter);
+
 /**@}*/
 
 #ifdef __cplusplus
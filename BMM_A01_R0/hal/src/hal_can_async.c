@@ -47,6 +47,12 @@ static void can_tx_done(struct _can_async_device *dev);
  * \param[in] dev The pointer to CAN device structure
  */
 static void can_rx_done(struct _can_async_device *dev);
+/**
+ * \internal Callback of CAN Message Read finished on Rx FIFO 1
+ *
+ * \param[in] dev The pointer to CAN device structure
+ */
+static void can_rx1_done(struct _can_async_device *dev);
 /**
  * \internal Callback of CAN Interrupt
  *
@@ -70,6 +76,7 @@ int32_t can_async_init(struct can_async_descriptor *const descr, void *const hw)
 	}
 	descr->dev.cb.tx_done     = can_tx_done;
 	descr->dev.cb.rx_done     = can_rx_done;
+	descr->dev.cb.rx1_done    = can_rx1_done;
 	descr->dev.cb.irq_handler = can_irq_handler;
 
 	return ERR_NONE;
@@ -111,6 +118,15 @@ int32_t can_async_read(struct can_async_descriptor *const descr, struct can_mess
 	return _can_async_read(&descr->dev, msg);
 }
 
+/**
+ * \brief Read a CAN message from Rx FIFO 1
+ */
+int32_t can_async_read_fifo1(struct can_async_descriptor *const descr, struct can_message *msg)
+{
+	ASSERT(descr && msg);
+	return _can_async_read_fifo1(&descr->dev, msg);
+}
+
 /**
  * \brief Write a CAN message
  */
@@ -120,6 +136,51 @@ int32_t can_async_write(struct can_async_descriptor *const descr, struct can_mes
 	return _can_async_write(&descr->dev, msg);
 }
 
+/**
+ * \brief Get the data field of the next free TX FIFO element
+ */
+uint8_t *can_async_tx_buffer(struct can_async_descriptor *const descr)
+{
+	ASSERT(descr);
+	return _can_async_tx_buffer(&descr->dev);
+}
+
+/**
+ * \brief Send a CAN message built with can_async_tx_buffer()
+ */
+int32_t can_async_tx_commit(struct can_async_descriptor *const descr, struct can_message *msg)
+{
+	ASSERT(descr && msg);
+	return _can_async_tx_commit(&descr->dev, msg);
+}
+
+/**
+ * \brief Load a dedicated TX buffer without requesting transmission
+ */
+int32_t can_async_set_tx_buffer(struct can_async_descriptor *const descr, uint8_t index, struct can_message *msg)
+{
+	ASSERT(descr && msg);
+	return _can_async_set_tx_buffer(&descr->dev, index, msg);
+}
+
+/**
+ * \brief Request transmission of dedicated TX buffers
+ */
+void can_async_send_tx_buffers(struct can_async_descriptor *const descr, uint32_t mask)
+{
+	ASSERT(descr);
+	_can_async_send_tx_buffers(&descr->dev, mask);
+}
+
+/**
+ * \brief Read the timestamp counter
+ */
+uint16_t can_async_get_timestamp(struct can_async_descriptor *const descr)
+{
+	ASSERT(descr);
+	return _can_async_get_timestamp(&descr->dev);
+}
+
 /**
  * \brief Register CAN callback function to interrupt
  */
@@ -132,6 +193,9 @@ int32_t can_async_register_callback(struct can_async_descriptor *const descr, en
 	case CAN_ASYNC_RX_CB:
 		descr->cb.rx_done = (cb != NULL) ? (can_cb_t)cb : NULL;
 		break;
+	case CAN_ASYNC_RX1_CB:
+		descr->cb.rx1_done = (cb != NULL) ? (can_cb_t)cb : NULL;
+		break;
 	case CAN_ASYNC_TX_CB:
 		descr->cb.tx_done = (cb != NULL) ? (can_cb_t)cb : NULL;
 		break;
@@ -185,6 +249,16 @@ int32_t can_async_set_filter(struct can_async_descriptor *const descr, uint8_t i
 	return _can_async_set_filter(&descr->dev, index, fmt, filter);
 }
 
+/**
+ * \brief Set CAN filter storing matches in Rx FIFO 1
+ */
+int32_t can_async_set_priority_filter(struct can_async_descriptor *const descr, uint8_t index, enum can_format fmt,
+                                      struct can_filter *filter)
+{
+	ASSERT(descr);
+	return _can_async_set_priority_filter(&descr->dev, index, fmt, filter);
+}
+
 /**
  * \brief Retrieve the current driver version
  */
@@ -217,6 +291,18 @@ static void can_rx_done(struct _can_async_device *dev)
 	}
 }
 
+/**
+ * \internal Callback of CAN Message Read finished on Rx FIFO 1
+ */
+static void can_rx1_done(struct _can_async_device *dev)
+{
+	struct can_async_descriptor *const descr = CONTAINER_OF(dev, struct can_async_descriptor, dev);
+
+	if (descr->cb.rx1_done) {
+		descr->cb.rx1_done(descr);
+	}
+}
+
 /**
  * \internal Callback of CAN Interrupt
  */
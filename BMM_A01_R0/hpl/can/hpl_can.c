@@ -60,7 +60,9 @@ static struct _can_async_device *_can0_dev     = NULL; /*!< Pointer to hpl devic
 COMPILER_ALIGNED(4)
 uint8_t can1_rx_fifo[CONF_CAN1_F0DS * CONF_CAN1_RXF0C_F0S];
 COMPILER_ALIGNED(4)
-uint8_t can1_tx_fifo[CONF_CAN1_TBDS * CONF_CAN1_TXBC_TFQS];
+uint8_t can1_rx_fifo1[CONF_CAN1_F1DS * CONF_CAN1_RXF1C_F1S];
+COMPILER_ALIGNED(4)
+uint8_t can1_tx_fifo[CONF_CAN1_TBDS * (CONF_CAN1_TXBC_NDTB + CONF_CAN1_TXBC_TFQS)];
 COMPILER_ALIGNED(4)
 static struct _can_tx_event_entry can1_tx_event_fifo[CONF_CAN1_TXEFC_EFS];
 COMPILER_ALIGNED(4)
@@ -122,6 +124,7 @@ int32_t _can_async_init(struct _can_async_device *const dev, void *const hw)
 		hri_can_write_NBTP_reg(dev->hw, CONF_CAN1_BTP_REG);
 		hri_can_write_DBTP_reg(dev->hw, CONF_CAN1_DBTP_REG);
 		hri_can_write_RXF0C_reg(dev->hw, CONF_CAN1_RXF0C_REG | CAN_RXF0C_F0SA((uint32_t)can1_rx_fifo));
+		hri_can_write_RXF1C_reg(dev->hw, CONF_CAN1_RXF1C_REG | CAN_RXF1C_F1SA((uint32_t)can1_rx_fifo1));
 		hri_can_write_RXESC_reg(dev->hw, CONF_CAN1_RXESC_REG);
 		hri_can_write_TXESC_reg(dev->hw, CONF_CAN1_TXESC_REG);
 		hri_can_write_TXBC_reg(dev->hw, CONF_CAN1_TXBC_REG | CAN_TXBC_TBSA((uint32_t)can1_tx_fifo));
@@ -130,6 +133,7 @@ int32_t _can_async_init(struct _can_async_device *const dev, void *const hw)
 		hri_can_write_SIDFC_reg(dev->hw, CONF_CAN1_SIDFC_REG | CAN_SIDFC_FLSSA((uint32_t)can1_rx_std_filter));
 		hri_can_write_XIDFC_reg(dev->hw, CONF_CAN1_XIDFC_REG | CAN_XIDFC_FLESA((uint32_t)can1_rx_ext_filter));
 		hri_can_write_XIDAM_reg(dev->hw, CONF_CAN1_XIDAM_REG);
+		hri_can_write_TSCC_reg(dev->hw, CONF_CAN1_TSCC_REG);
 
 		NVIC_DisableIRQ(CAN1_IRQn);
 		NVIC_ClearPendingIRQ(CAN1_IRQn);
@@ -175,12 +179,41 @@ int32_t _can_async_disable(struct _can_async_device *const dev)
 	return ERR_NONE;
 }
 
+/**
+ * \brief Copy a received element into msg, at most size data bytes
+ */
+static void _can_async_read_entry(struct _can_rx_fifo_entry *f, struct can_message *msg, uint8_t size)
+{
+	if (f->R0.bit.XTD == 1) {
+		msg->fmt = CAN_FMT_EXTID;
+		msg->id  = f->R0.bit.ID;
+	} else {
+		msg->fmt = CAN_FMT_STDID;
+		/* A standard identifier is stored into ID[28:18] */
+		msg->id = f->R0.bit.ID >> 18;
+	}
+
+	if (f->R0.bit.RTR == 1) {
+		msg->type = CAN_TYPE_REMOTE;
+	}
+
+	const uint8_t dlc2len[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64};
+	msg->len                = dlc2len[f->R1.bit.DLC];
+	msg->timestamp          = f->R1.bit.RXTS;
+	if (msg->len > size) {
+		msg->len = size;
+	}
+
+	memcpy(msg->data, f->data, msg->len);
+}
+
 /**
  * \brief Read a CAN message
  */
 int32_t _can_async_read(struct _can_async_device *const dev, struct can_message *msg)
 {
-	struct _can_rx_fifo_entry *f = NULL;
+	struct _can_rx_fifo_entry *f    = NULL;
+	uint8_t                    size = 0;
 	hri_can_rxf0s_reg_t        get_index;
 
 	if (!hri_can_read_RXF0S_F0FL_bf(dev->hw)) {
@@ -189,14 +222,17 @@ int32_t _can_async_read(struct _can_async_device *const dev, struct can_message
 
 	get_index = hri_can_read_RXF0S_F0GI_bf(dev->hw);
 
+	/* Only the configured data field is stored, whatever the DLC */
 #ifdef CONF_CAN0_ENABLED
 	if (dev->hw == CAN0) {
-		f = (struct _can_rx_fifo_entry *)(can0_rx_fifo + get_index * CONF_CAN0_F0DS);
+		f    = (struct _can_rx_fifo_entry *)(can0_rx_fifo + get_index * CONF_CAN0_F0DS);
+		size = CONF_CAN0_F0DS - 8;
 	}
 #endif
 #ifdef CONF_CAN1_ENABLED
 	if (dev->hw == CAN1) {
-		f = (struct _can_rx_fifo_entry *)(can1_rx_fifo + get_index * CONF_CAN1_F0DS);
+		f    = (struct _can_rx_fifo_entry *)(can1_rx_fifo + get_index * CONF_CAN1_F0DS);
+		size = CONF_CAN1_F0DS - 8;
 	}
 #endif
 
@@ -204,25 +240,39 @@ int32_t _can_async_read(struct _can_async_device *const dev, struct can_message
 		return ERR_NO_RESOURCE;
 	}
 
-	if (f->R0.bit.XTD == 1) {
-		msg->fmt = CAN_FMT_EXTID;
-		msg->id  = f->R0.bit.ID;
-	} else {
-		msg->fmt = CAN_FMT_STDID;
-		/* A standard identifier is stored into ID[28:18] */
-		msg->id = f->R0.bit.ID >> 18;
-	}
+	_can_async_read_entry(f, msg, size);
+	hri_can_write_RXF0A_F0AI_bf(dev->hw, get_index);
 
-	if (f->R0.bit.RTR == 1) {
-		msg->type = CAN_TYPE_REMOTE;
+	return ERR_NONE;
+}
+
+/**
+ * \brief Read a CAN message from Rx FIFO 1
+ */
+int32_t _can_async_read_fifo1(struct _can_async_device *const dev, struct can_message *msg)
+{
+	struct _can_rx_fifo_entry *f = NULL;
+	hri_can_rxf1s_reg_t        get_index;
+
+	if (!hri_can_read_RXF1S_F1FL_bf(dev->hw)) {
+		return ERR_NOT_FOUND;
 	}
 
-	const uint8_t dlc2len[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64};
-	msg->len                = dlc2len[f->R1.bit.DLC];
+	get_index = hri_can_read_RXF1S_F1GI_bf(dev->hw);
 
-	memcpy(msg->data, f->data, msg->len);
+#ifdef CONF_CAN1_ENABLED
+	if (dev->hw == CAN1) {
+		f = (struct _can_rx_fifo_entry *)(can1_rx_fifo1 + get_index * CONF_CAN1_F1DS);
+	}
+#endif
 
-	hri_can_write_RXF0A_F0AI_bf(dev->hw, get_index);
+	if (f == NULL) {
+		return ERR_NO_RESOURCE;
+	}
+
+	/* Only the configured data field is stored, whatever the DLC */
+	_can_async_read_entry(f, msg, CONF_CAN1_F1DS - 8);
+	hri_can_write_RXF1A_F1AI_bf(dev->hw, get_index);
 
 	return ERR_NONE;
 }
@@ -231,10 +281,23 @@ int32_t _can_async_read(struct _can_async_device *const dev, struct can_message
  * \brief Write a CAN message
  */
 int32_t _can_async_write(struct _can_async_device *const dev, struct can_message *msg)
+{
+	uint8_t *data = _can_async_tx_buffer(dev);
+	if (data == NULL) {
+		return ERR_NO_RESOURCE;
+	}
+	memcpy(data, msg->data, msg->len);
+	return _can_async_tx_commit(dev, msg);
+}
+
+/**
+ * \brief Get the TX FIFO element at the put index, or NULL if full
+ */
+static struct _can_tx_fifo_entry *_can_async_tx_entry(struct _can_async_device *const dev)
 {
 	struct _can_tx_fifo_entry *f = NULL;
 	if (hri_can_get_TXFQS_TFQF_bit(dev->hw)) {
-		return ERR_NO_RESOURCE;
+		return NULL;
 	}
 #ifdef CONF_CAN0_ENABLED
 	if (dev->hw == CAN0) {
@@ -246,10 +309,24 @@ int32_t _can_async_write(struct _can_async_device *const dev, struct can_message
 		f = (struct _can_tx_fifo_entry *)(can1_tx_fifo + hri_can_read_TXFQS_TFQPI_bf(dev->hw) * CONF_CAN1_TBDS);
 	}
 #endif
-	if (f == NULL) {
-		return ERR_NO_RESOURCE;
-	}
+	return f;
+}
 
+/**
+ * \brief Get the data field of the next free TX FIFO element
+ */
+uint8_t *_can_async_tx_buffer(struct _can_async_device *const dev)
+{
+	struct _can_tx_fifo_entry *f = _can_async_tx_entry(dev);
+	return f ? (uint8_t *)f->data : NULL;
+}
+
+/**
+ * \brief Fill in the ID, DLC and format of a TX element
+ */
+static void _can_async_tx_header(struct _can_async_device *const dev, struct _can_tx_fifo_entry *f,
+                                 struct can_message *msg)
+{
 	if (msg->fmt == CAN_FMT_EXTID) {
 		f->R0.val     = msg->id;
 		f->R0.bit.XTD = 1;
@@ -275,13 +352,71 @@ int32_t _can_async_write(struct _can_async_device *const dev, struct can_message
 	} else if (msg->len <= 64) {
 		f->R1.bit.DLC = 0xF;
 	}
+	/* Frames longer than 8 bytes are only possible in FD format */
+	f->R1.bit.FDF = msg->len > 8;
+	f->R1.bit.BRS = f->R1.bit.FDF && hri_can_get_CCCR_BRSE_bit(dev->hw);
+}
 
-	memcpy(f->data, msg->data, msg->len);
-
+/**
+ * \brief Send the frame in the next free TX FIFO element
+ */
+int32_t _can_async_tx_commit(struct _can_async_device *const dev, struct can_message *msg)
+{
+	struct _can_tx_fifo_entry *f = _can_async_tx_entry(dev);
+	if (f == NULL) {
+		return ERR_NO_RESOURCE;
+	}
+	_can_async_tx_header(dev, f, msg);
 	hri_can_write_TXBAR_reg(dev->hw, 1 << hri_can_read_TXFQS_TFQPI_bf(dev->hw));
 	return ERR_NONE;
 }
 
+/**
+ * \brief Load a dedicated TX buffer without requesting transmission
+ */
+int32_t _can_async_set_tx_buffer(struct _can_async_device *const dev, uint8_t index, struct can_message *msg)
+{
+	struct _can_tx_fifo_entry *f = NULL;
+	if (index >= hri_can_read_TXBC_NDTB_bf(dev->hw)) {
+		return ERR_INVALID_ARG;
+	}
+	if (hri_can_get_TXBRP_reg(dev->hw, 1 << index)) {
+		return ERR_BUSY;
+	}
+#ifdef CONF_CAN0_ENABLED
+	if (dev->hw == CAN0) {
+		f = (struct _can_tx_fifo_entry *)(can0_tx_fifo + index * CONF_CAN0_TBDS);
+	}
+#endif
+#ifdef CONF_CAN1_ENABLED
+	if (dev->hw == CAN1) {
+		f = (struct _can_tx_fifo_entry *)(can1_tx_fifo + index * CONF_CAN1_TBDS);
+	}
+#endif
+	if (f == NULL) {
+		return ERR_NO_RESOURCE;
+	}
+	_can_async_tx_header(dev, f, msg);
+	memcpy(f->data, msg->data, msg->len);
+	return ERR_NONE;
+}
+
+/**
+ * \brief Request transmission of dedicated TX buffers
+ */
+void _can_async_send_tx_buffers(struct _can_async_device *const dev, uint32_t mask)
+{
+	hri_can_write_TXBAR_reg(dev->hw, mask);
+}
+
+/**
+ * \brief Read the timestamp counter
+ */
+uint16_t _can_async_get_timestamp(struct _can_async_device *const dev)
+{
+	return hri_can_read_TSCV_reg(dev->hw);
+}
+
 /**
  * \brief Set CAN Interrupt State
  */
@@ -291,11 +426,13 @@ void _can_async_set_irq_state(struct _can_async_device *const dev, enum can_asyn
 
 	if (type == CAN_ASYNC_RX_CB) {
 		hri_can_write_IE_RF0NE_bit(dev->hw, state);
+	} else if (type == CAN_ASYNC_RX1_CB) {
+		hri_can_write_IE_RF1NE_bit(dev->hw, state);
 	} else if (type == CAN_ASYNC_TX_CB) {
 		hri_can_write_IE_TCE_bit(dev->hw, state);
 		hri_can_write_TXBTIE_reg(dev->hw, CAN_TXBTIE_MASK);
 	} else if (type == CAN_ASYNC_IRQ_CB) {
-		ie = hri_can_get_IE_reg(dev->hw, CAN_IE_RF0NE | CAN_IE_TCE);
+		ie = hri_can_get_IE_reg(dev->hw, CAN_IE_RF0NE | CAN_IE_RF1NE | CAN_IE_TCE);
 		hri_can_write_IE_reg(dev->hw, ie | CONF_CAN0_IE_REG);
 	}
 
@@ -378,6 +515,24 @@ int32_t _can_async_set_filter(struct _can_async_device *const dev, uint8_t index
 	return ERR_NONE;
 }
 
+/**
+ * \brief Set a filter that stores matching frames in Rx FIFO 1
+ */
+int32_t _can_async_set_priority_filter(struct _can_async_device *const dev, uint8_t index, enum can_format fmt,
+                                       struct can_filter *filter)
+{
+	int32_t rc = _can_async_set_filter(dev, index, fmt, filter);
+	if (rc != ERR_NONE || filter == NULL) {
+		return rc;
+	}
+	if (fmt == CAN_FMT_STDID) {
+		((struct _can_context *)dev->context)->rx_std_filter[index].S0.bit.SFEC = _CAN_SFEC_PRIF1M;
+	} else if (fmt == CAN_FMT_EXTID) {
+		((struct _can_context *)dev->context)->rx_ext_filter[index].F0.bit.EFEC = _CAN_EFEC_PRIF1M;
+	}
+	return ERR_NONE;
+}
+
 /*
  * \brief CAN interrupt handler
  */
@@ -386,6 +541,15 @@ void CAN1_Handler(void)
 	struct _can_async_device *dev = _can1_dev;
 	uint32_t                  ir;
 	ir = hri_can_read_IR_reg(dev->hw);
+	/* Clear the flags before servicing them. Frames received or sent
+	 * while the callbacks run set their flags again and re-enter the
+	 * handler rather than being cleared unseen. */
+	hri_can_write_IR_reg(dev->hw, ir);
+
+	/* Priority frames first */
+	if (ir & CAN_IR_RF1N) {
+		dev->cb.rx1_done(dev);
+	}
 
 	if (ir & CAN_IR_RF0N) {
 		dev->cb.rx_done(dev);
@@ -410,6 +574,4 @@ void CAN1_Handler(void)
 	if (ir & CAN_IR_RF0L) {
 		dev->cb.irq_handler(dev, CAN_IRQ_DO);
 	}
-
-	hri_can_write_IR_reg(dev->hw, ir);
 }
@@ -6,10 +6,13 @@
 #include "atmel_start_pins.h"
 #include "i2c.h"
 #include "subbus.h"
+#include "can_control.h"
 
 static bool i2c_enabled = I2C_ENABLE_DEFAULT;
 static struct io_descriptor *I2C_io;
 static volatile bool I2C_txfr_complete = true;
+/** can_control_timestamp() when the last transfer completed */
+static volatile uint16_t I2C_txfr_ts = 0;
 static volatile bool I2C_error_seen = false;
 static volatile int32_t I2C_error = I2C_OK;
 static volatile uint8_t pm_ov_status = 0;
@@ -28,28 +31,29 @@ static enum pm_state_t pm_state = pm_init;
  * 0x22 R:  PwrMon_V
  * 0x23 R:  PwrMon_V2
  * 0x24 R:  PwrMon_N
- * 0x25 R:  T1
- * 0x26 R:  T2
+ * 0x25 R:  PwrMon_Status
+ * 0x26 R:  T1
+ * 0x27 R:  T2
+ * 0x28 R:  ADS_N
+ * 0x29 R:  PwrMon sample time
+ * 0x2A R:  T1 sample time
+ * 0x2B R:  T2 sample time
+ * Sample times are can_control_timestamp() values captured when the
+ * I2C read completed, so they share a timebase with CAN reception
+ * timestamps (see CAN_TS_BASE_ADDR).
  */
-static subbus_cache_word_t i2c_cache[I2C_HIGH_ADDR-I2C_BASE_ADDR+1] = {
-  { 0, 0, true,  false,  false, false, false }, // Offset 0: R: I2C Status
-  { 0, 0, true,  false, false, false, false },  // Offset 1: R: PwrMon_I
-  { 0, 0, true,  false, false, false, false },  // Offset 2: R: PwrMon_V
-  { 0, 0, true,  false, false, false, false },  // Offset 3: R: PwrMon_V2
-  { 0, 0, true,  false, false, false, false },  // Offset 4: R: PwrMon_N
-  { 0, 0, true,  false, false, false, false },  // Offset 5: R: PwrMon_Status
-  { 0, 0, true,  false,  true, false, false },  // Offset 6: R: T1
-  { 0, 0, true,  false, false, false, false },  // Offset 7: R: T2
-  { 0, 0, true,  false, false, false, false }   // Offset 8: R: ADS_N
-};
+static uint16_t i2c_cache[I2C_HIGH_ADDR-I2C_BASE_ADDR+1];
+static uint16_t i2c_wvalue[I2C_HIGH_ADDR-I2C_BASE_ADDR+1];
+#define PM_READINGS_MASK SUBBUS_BITS(1,4)
+#define PM_STATUS_MASK SUBBUS_BIT(5)
 
 static void  pm_record_i2c_error(enum pm_state_t pm_state, int32_t I2C_error) {
   uint16_t word = ((pm_state & 0x7) << 4) | (I2C_error & 0xF);
-  i2c_cache[5].cache = (i2c_cache[5].cache & 0xFF00) | word;
+  subbus_cache_update(&sb_i2c, I2C_BASE_ADDR+5, (i2c_cache[5] & 0xFF00) | word);
 }
 
 static void pm_record_ov_status(uint8_t ovs) {
-  i2c_cache[5].cache = (i2c_cache[5].cache & 0xFCFF) | ((ovs & 3) << 8);
+  subbus_cache_update(&sb_i2c, I2C_BASE_ADDR+5, (i2c_cache[5] & 0xFCFF) | ((ovs & 3) << 8));
 }
 
 /**
@@ -59,15 +63,15 @@ static bool pm_poll(void) {
   static int n_readings = 0;
   // static int64_t sum = 0;
 
-  if (i2c_cache[1].was_read && i2c_cache[2].was_read && i2c_cache[3].was_read && i2c_cache[4].was_read) {
+  if (subbus_cache_all_read(&sb_i2c, PM_READINGS_MASK)) {
     n_readings = 0;
-    i2c_cache[1].was_read = i2c_cache[2].was_read = i2c_cache[3].was_read = i2c_cache[4].was_read = false;
+    subbus_cache_clear_read(&sb_i2c, PM_READINGS_MASK);
   }
-  if (i2c_cache[5].was_read) {
+  if (subbus_cache_all_read(&sb_i2c, PM_STATUS_MASK)) {
     pm_ov_status = 0;
     pm_record_ov_status(pm_ov_status);
     I2C_error = I2C_OK;
-    i2c_cache[5].was_read = false;
+    subbus_cache_clear_read(&sb_i2c, PM_STATUS_MASK);
     pm_record_i2c_error(pm_state, I2C_OK);
   }
 
@@ -84,10 +88,13 @@ static bool pm_poll(void) {
         pm_record_i2c_error(pm_state, I2C_error);
         pm_state = pm_init;
       } else {
-        i2c_cache[1].cache = (pm_ibuf[0]<<8) | pm_ibuf[1];
-        i2c_cache[2].cache = (pm_ibuf[2]<<8) | pm_ibuf[3];
-        i2c_cache[3].cache = (pm_ibuf[4]<<8) | pm_ibuf[5];
-        i2c_cache[4].cache = ++n_readings;
+        subbus_cache_begin();
+        subbus_cache_update(&sb_i2c, I2C_BASE_ADDR+1, (pm_ibuf[0]<<8) | pm_ibuf[1]);
+        subbus_cache_update(&sb_i2c, I2C_BASE_ADDR+2, (pm_ibuf[2]<<8) | pm_ibuf[3]);
+        subbus_cache_update(&sb_i2c, I2C_BASE_ADDR+3, (pm_ibuf[4]<<8) | pm_ibuf[5]);
+        subbus_cache_update(&sb_i2c, I2C_BASE_ADDR+4, ++n_readings);
+        subbus_cache_update(&sb_i2c, I2C_BASE_ADDR+9, I2C_txfr_ts);
+        subbus_cache_end();
         pm_state = pm_init;
       }
       return true;
@@ -153,8 +160,11 @@ static bool ads1115_poll(void) {
       ads_state = ads_t1_read_adc_tx;
       return false;
     case ads_t1_read_adc_tx:
-      i2c_cache[6].cache = (ads_ibuf[0] << 8) | ads_ibuf[1];
-      i2c_cache[8].cache = ads_n_reads;
+      subbus_cache_begin();
+      subbus_cache_update(&sb_i2c, I2C_BASE_ADDR+6, (ads_ibuf[0] << 8) | ads_ibuf[1]);
+      subbus_cache_update(&sb_i2c, I2C_BASE_ADDR+8, ads_n_reads);
+      subbus_cache_update(&sb_i2c, I2C_BASE_ADDR+10, I2C_txfr_ts);
+      subbus_cache_end();
       ads_state = ads_t2_init;
       return true;
     case ads_t2_init:
@@ -194,8 +204,11 @@ static bool ads1115_poll(void) {
       ads_state = ads_t2_read_adc_tx;
       return false;
     case ads_t2_read_adc_tx:
-      i2c_cache[7].cache = (ads_ibuf[0] << 8) | ads_ibuf[1];
-      i2c_cache[8].cache = ads_n_reads;
+      subbus_cache_begin();
+      subbus_cache_update(&sb_i2c, I2C_BASE_ADDR+7, (ads_ibuf[0] << 8) | ads_ibuf[1]);
+      subbus_cache_update(&sb_i2c, I2C_BASE_ADDR+8, ads_n_reads);
+      subbus_cache_update(&sb_i2c, I2C_BASE_ADDR+11, I2C_txfr_ts);
+      subbus_cache_end();
       ads_state = ads_t1_init;
       return true;
     default:
@@ -214,6 +227,7 @@ static void I2C_async_error(struct i2c_m_async_desc *const i2c, int32_t error) {
   I2C_txfr_complete = true;
   I2C_error_seen = true;
   I2C_error = error;
+  subbus_mark_ready(&sb_i2c);
   if (error == I2C_ERR_BUS) {
     hri_sercomi2cm_write_STATUS_reg(I2C.device.hw, SERCOM_I2CM_STATUS_BUSERR);
     hri_sercomi2cm_clear_INTFLAG_reg(I2C.device.hw, I2C_INTFLAG_ERROR);
@@ -221,7 +235,9 @@ static void I2C_async_error(struct i2c_m_async_desc *const i2c, int32_t error) {
 }
 
 static void I2C_txfr_completed(struct i2c_m_async_desc *const i2c) {
+  I2C_txfr_ts = can_control_timestamp();
   I2C_txfr_complete = true;
+  subbus_mark_ready(&sb_i2c);
 }
 
 static void i2c_reset() {
@@ -264,11 +280,19 @@ void i2c_poll(void) {
     }
     if (i2c_state == input_state) break;
   }
+  // Normally a transfer is now in flight and its completion callback
+  // will mark us ready. If not, come back on the next pass.
+  if (i2c_enabled && I2C_txfr_complete) {
+    subbus_mark_ready(&sb_i2c);
+  }
 }
 
 subbus_driver_t sb_i2c = {
   I2C_BASE_ADDR, I2C_HIGH_ADDR, // address range
-  i2c_cache,
+  i2c_cache, i2c_wvalue,
+  SUBBUS_BITS(0, I2C_HIGH_ADDR-I2C_BASE_ADDR), // readable
+  SUBBUS_BIT(6), // writable
+  0, 0, 0, // dynamic, was_read, written
   i2c_reset,
   i2c_poll,
   0, // Dynamic function
@@ -0,0 +1,134 @@
+/** @file latch.c
+ * Synchronized snapshots of the acquisition registers. A write to
+ * 0x70 copies the live registers into the snapshot bank and stamps it.
+ * When the write is sent to CAN_BROADCAST_ID, the receive interrupt
+ * takes the snapshot as soon as the frame arrives (see
+ * can_control.c), so every board on the bus latches within
+ * microseconds of the same moment regardless of what its main loop is
+ * doing. The host can then read coherent readings from each board
+ * afterwards at leisure.
+ *
+ * Times are in counts of the CAN timestamp counter, see
+ * can_control_timestamp(). Each board's counter is free-running, but a
+ * broadcast trigger frame is received by all boards at once, so its
+ * reception time is a common reference point.
+ *
+ * 0x70 W: Any value latches a snapshot
+ *      R: Snapshots taken (wraps)
+ * 0x71 R: Reception time of the broadcast trigger frame, or the time of
+ *   the snapshot if it was triggered some other way. The controller
+ *   stamps a frame at its start of frame.
+ * 0x72 R: Delay from 0x71 to the snapshot. This includes the trigger
+ *   frame's own transmission, about 85-100 bit times for the 5-byte
+ *   write depending on bit stuffing, so it is normally that plus a few
+ *   counts. It is longer if the trigger interrupted the main loop
+ *   while it was updating a group of these registers, and the
+ *   snapshot had to wait for the update to finish.
+ * 0x73-0x7A R: Snapshot of 0x21-0x28: PwrMon I, V, V2, N, status, T1,
+ *   T2, T reads
+ * 0x7B R: Snapshot of 0x30: Command status
+ */
+#include <string.h>
+#include <hal_atomic.h>
+#include "latch.h"
+#include "i2c.h"
+#include "commands.h"
+#include "can_control.h"
+
+#define LATCH_COUNT 0
+#define LATCH_TIME 1
+#define LATCH_DELAY 2
+#define LATCH_BANK 3
+
+/** Addresses copied into the snapshot bank, in order */
+static const uint8_t latch_addrs[] = {
+  I2C_BASE_ADDR+1, I2C_BASE_ADDR+2, I2C_BASE_ADDR+3, I2C_BASE_ADDR+4,
+  I2C_BASE_ADDR+5, I2C_BASE_ADDR+6, I2C_BASE_ADDR+7, I2C_BASE_ADDR+8,
+  CMD_BASE_ADDR
+};
+#define LATCH_N_ADDRS (sizeof(latch_addrs)/sizeof(latch_addrs[0]))
+
+static uint16_t latch_cache[LATCH_HIGH_ADDR-LATCH_BASE_ADDR+1];
+static uint16_t latch_wvalue[LATCH_HIGH_ADDR-LATCH_BASE_ADDR+1];
+
+/** A trigger is waiting for the main loop to finish a cache update */
+static volatile bool latch_deferred = false;
+static uint16_t latch_deferred_ts;
+
+/**
+ * Copies the live registers with subbus_peek_isr() so the snapshot does
+ * not count as a host read of them. Must be called with interrupts held
+ * off, or from an interrupt handler, so the bank is never seen half
+ * written.
+ * @param ts The time of the trigger
+ * @return false if the main loop is part way through updating a group
+ *   of the registers. Nothing is copied.
+ */
+static bool latch_copy(uint16_t ts) {
+  uint16_t bank[LATCH_N_ADDRS];
+  unsigned i;
+  for (i = 0; i < LATCH_N_ADDRS; ++i) {
+    if (!subbus_peek_isr(latch_addrs[i], &bank[i])) {
+      return false;
+    }
+  }
+  memcpy(&latch_cache[LATCH_BANK], bank, sizeof(bank));
+  latch_cache[LATCH_TIME] = ts;
+  latch_cache[LATCH_DELAY] = can_control_timestamp() - ts;
+  ++latch_cache[LATCH_COUNT];
+  return true;
+}
+
+/**
+ * Takes a snapshot from interrupt context. If the main loop was
+ * interrupted in the middle of updating the registers, the snapshot is
+ * completed by latch_poll() as soon as the update is done.
+ * @param rx_ts The reception time of the trigger frame
+ */
+void latch_trigger(uint16_t rx_ts) {
+  if (!latch_copy(rx_ts)) {
+    latch_deferred_ts = rx_ts;
+    latch_deferred = true;
+    subbus_mark_ready(&sb_latch);
+  }
+}
+
+static void latch_reset(void) {
+  memset(latch_cache, 0, sizeof(latch_cache));
+  latch_deferred = false;
+}
+
+static void latch_poll(void) {
+  CRITICAL_SECTION_ENTER()
+  if (latch_deferred && latch_copy(latch_deferred_ts)) {
+    latch_deferred = false;
+  }
+  CRITICAL_SECTION_LEAVE()
+}
+
+/**
+ * Triggers that arrive through subbus_write(), from serial or a CAN
+ * request to this board alone
+ */
+static void latch_action(void) {
+  uint16_t value;
+  if (subbus_cache_iswritten(&sb_latch, LATCH_TRIGGER_ADDR, &value)) {
+    CRITICAL_SECTION_ENTER()
+    latch_copy(can_control_timestamp());
+    latch_deferred = false;
+    CRITICAL_SECTION_LEAVE()
+  }
+}
+
+subbus_driver_t sb_latch = {
+  LATCH_BASE_ADDR, LATCH_HIGH_ADDR, // address range
+  latch_cache, latch_wvalue,
+  SUBBUS_BITS(LATCH_COUNT, LATCH_BANK+LATCH_N_ADDRS-1), // readable
+  SUBBUS_BIT(LATCH_COUNT), // writable
+  SUBBUS_BIT(LATCH_COUNT), // dynamic
+  0, 0, // was_read, written
+  latch_reset,
+  latch_poll,
+  latch_action,
+  false
+};
@@ -0,0 +1,14 @@
+#ifndef LATCH_H_INCLUDED
+#define LATCH_H_INCLUDED
+#include <stdint.h>
+#include "subbus.h"
+
+#define LATCH_BASE_ADDR 0x70
+#define LATCH_HIGH_ADDR 0x7B
+/** Write any value here, usually as a CAN_BROADCAST_ID write, to latch */
+#define LATCH_TRIGGER_ADDR LATCH_BASE_ADDR
+
+extern subbus_driver_t sb_latch;
+void latch_trigger(uint16_t rx_ts);
+
+#endif
@@ -5,6 +5,13 @@
 #include "control.h"
 #include "i2c.h"
 #include "commands.h"
+#include "tick.h"
+#include "publish.h"
+#include "cov.h"
+#include "latch.h"
+#if SUBBUS_PROFILE
+#include "prof.h"
+#endif
 
 int main(void)
 {
@@ -14,19 +21,38 @@ int main(void)
   if (subbus_add_driver(&sb_base)
       || subbus_add_driver(&sb_fail_sw)
       || subbus_add_driver(&sb_can_desc)
+#if SUBBUS_INTERRUPTS
+      || subbus_add_driver(&sb_intr)
+#endif
       || subbus_add_driver(&sb_i2c)
       || subbus_add_driver(&sb_cmd)
       || subbus_add_driver(&sb_can)
+      || subbus_add_driver(&sb_can_ts)
+      || subbus_add_driver(&sb_pub)
+      || subbus_add_driver(&sb_cov)
+      || subbus_add_driver(&sb_latch)
+#if SUBBUS_PROFILE
+      || subbus_add_driver(&sb_prof)
+#endif
      )
   {
     while (true) ; // some driver is misconfigured.
   }
   subbus_reset();
+  tick_init();
   while (1) {
     subbus_poll();
     #if SUBBUS_INTERRUPTS
       if (subbus_intr_req)
         intr_service();
     #endif
+    // Sleep until an interrupt marks a driver ready. WFI wakes on a
+    // pending interrupt even with interrupts masked, so a driver
+    // marked ready after the check cannot be missed.
+    __disable_irq();
+    if (!subbus_pending()) {
+      __WFI();
+    }
+    __enable_irq();
   }
 }
@@ -0,0 +1,142 @@
+/** @file prof.c
+ * Execution time statistics for each pass of subbus_poll() and for
+ * each driver's poll function, measured with tick_cycles().
+ *
+ * These addresses belong to the profiler. Statistics are reported for
+ * the entity selected at 0x40, in microseconds.
+ * 0x40 RW: Select: 0 for subbus_poll() passes, i+1 for the ith driver
+ * 0x41 R:  Number of entities
+ * 0x42 R:  Low address of the selected driver, 0xFFFF for the loop
+ * 0x43 R:  Count (saturates at 0xFFFF)
+ * 0x44 R:  Min
+ * 0x45 R:  Max
+ * 0x46 R:  Mean
+ * 0x47-0x4E R: Histogram. Bin k counts durations in [4^k, 4^(k+1)),
+ *   with bin 0 including 0 and bin 7 everything above:
+ *     0x47: 0-3       0x4B: 256-1023
+ *     0x48: 4-15      0x4C: 1024-4095
+ *     0x49: 16-63     0x4D: 4096-16383
+ *     0x4A: 64-255    0x4E: 16384 and up
+ *   The bins are powers of 4 rather than 2 so that the eight bins that
+ *   fit in the address range span everything from a trivial poll to a
+ *   16 ms stall. Power-of-2 bins would lump all passes over 128 us
+ *   together.
+ * 0x4F W:  Any value clears all statistics
+ */
+#include <string.h>
+#include "prof.h"
+#include "tick.h"
+
+#define PROF_SELECT 0
+#define PROF_N_ENTITIES 1
+#define PROF_ID 2
+#define PROF_COUNT 3
+#define PROF_MIN 4
+#define PROF_MAX 5
+#define PROF_MEAN 6
+#define PROF_HIST 7
+#define PROF_CLEAR 15
+
+typedef struct {
+  uint32_t count;
+  uint32_t sum;
+  uint16_t min, max;
+  uint16_t hist[PROF_N_BINS];
+} prof_stats_t;
+
+static prof_stats_t prof_stats[PROF_MAX_ENTITIES];
+static uint16_t prof_cache[PROF_HIGH_ADDR-PROF_BASE_ADDR+1];
+static uint16_t prof_wvalue[PROF_HIGH_ADDR-PROF_BASE_ADDR+1];
+
+uint32_t prof_start(void) {
+  return tick_cycles();
+}
+
+static int prof_bin(uint32_t us) {
+  int bin = 0;
+  while (us >= 4 && bin < PROF_N_BINS-1) {
+    us >>= 2;
+    ++bin;
+  }
+  return bin;
+}
+
+/**
+ * Copies the selected entity's statistics into the cache
+ */
+static void prof_update_cache(void) {
+  int entity = prof_cache[PROF_SELECT];
+  prof_stats_t *st = &prof_stats[entity];
+  subbus_driver_t *drv = entity ? subbus_get_driver(entity-1) : 0;
+  int i;
+
+  prof_cache[PROF_N_ENTITIES] = subbus_n_drivers()+1;
+  prof_cache[PROF_ID] = drv ? drv->low : 0xFFFF;
+  prof_cache[PROF_COUNT] = st->count > 0xFFFF ? 0xFFFF : st->count;
+  prof_cache[PROF_MIN] = st->min;
+  prof_cache[PROF_MAX] = st->max;
+  prof_cache[PROF_MEAN] = st->count ? st->sum/st->count : 0;
+  for (i = 0; i < PROF_N_BINS; ++i) {
+    prof_cache[PROF_HIST+i] = st->hist[i];
+  }
+}
+
+/**
+ * @brief Records one execution
+ * @param entity PROF_LOOP or the driver's index + 1
+ * @param start The value returned by prof_start() before execution
+ */
+void prof_record(int entity, uint32_t start) {
+  uint32_t us = (tick_cycles() - start)/TICK_CYCLES_PER_US;
+  prof_stats_t *st;
+  int bin;
+
+  if (entity < 0 || entity >= PROF_MAX_ENTITIES) return;
+  st = &prof_stats[entity];
+  if (us > 0xFFFF) us = 0xFFFF;
+  if (st->count == 0 || us < st->min) st->min = us;
+  if (us > st->max) st->max = us;
+  if (st->sum >= 0x80000000) {
+    // Halve both to keep the mean while avoiding overflow
+    st->sum /= 2;
+    st->count /= 2;
+  }
+  st->sum += us;
+  ++st->count;
+  bin = prof_bin(us);
+  if (st->hist[bin] < 0xFFFF) ++st->hist[bin];
+  if (entity == PROF_LOOP) {
+    prof_update_cache();
+  }
+}
+
+static void prof_reset(void) {
+  memset(prof_stats, 0, sizeof(prof_stats));
+  prof_cache[PROF_SELECT] = PROF_LOOP;
+  prof_update_cache();
+}
+
+static void prof_action(void) {
+  uint16_t value;
+  if (subbus_cache_iswritten(&sb_prof, PROF_BASE_ADDR+PROF_CLEAR, &value)) {
+    memset(prof_stats, 0, sizeof(prof_stats));
+  }
+  if (subbus_cache_iswritten(&sb_prof, PROF_BASE_ADDR+PROF_SELECT, &value) &&
+      value <= subbus_n_drivers()) {
+    prof_cache[PROF_SELECT] = value;
+  }
+  prof_update_cache();
+}
+
+subbus_driver_t sb_prof = {
+  PROF_BASE_ADDR, PROF_HIGH_ADDR, // address range
+  prof_cache, prof_wvalue,
+  SUBBUS_BITS(PROF_SELECT, PROF_HIST+PROF_N_BINS-1), // readable
+  SUBBUS_BIT(PROF_SELECT) | SUBBUS_BIT(PROF_CLEAR), // writable
+  SUBBUS_BIT(PROF_SELECT) | SUBBUS_BIT(PROF_CLEAR), // dynamic
+  0, 0, // was_read, written
+  prof_reset,
+  0, // poll
+  prof_action,
+  false
+};
@@ -0,0 +1,17 @@
+#ifndef PROF_H_INCLUDED
+#define PROF_H_INCLUDED
+#include <stdint.h>
+#include "subbus.h"
+
+#define PROF_BASE_ADDR 0x40
+#define PROF_HIGH_ADDR 0x4F
+#define PROF_N_BINS 8
+/** Entity 0 is a pass of subbus_poll(). Entity i+1 is the ith driver */
+#define PROF_LOOP 0
+#define PROF_MAX_ENTITIES (SUBBUS_MAX_DRIVERS+1)
+
+uint32_t prof_start(void);
+void prof_record(int entity, uint32_t start);
+extern subbus_driver_t sb_prof;
+
+#endif
@@ -0,0 +1,205 @@
+/** @file publish.c
+ * Periodic CAN telemetry. Every period, the registers in the publish
+ * list are read in one pass and broadcast on the publish CAN ID without
+ * a host request. Each frame carries the list index of its first value
+ * in byte 0, followed by up to 3 values (31 in CAN FD mode), LSB first.
+ * Values are taken from the subbus cache with subbus_peek(), so
+ * publishing has no read side effects and does not disturb a host that
+ * polls the same registers. FIFO registers publish their current head
+ * word without advancing.
+ *
+ * In staged mode, the frames are instead loaded into dedicated TX
+ * buffers every period and only sent when the host transmits a remote
+ * frame with the publish ID. The reply then goes out with no software
+ * formatting. All frames of a cycle must fit in CAN_STAGE_BUFFERS.
+ *
+ * 0x50 RW: Period in milliseconds. 0 disables publishing.
+ * 0x51 RW: CAN ID of publish frames in bits 0-10. Defaults to the
+ *   board's CAN_PUB_REQID reply ID. Set PUB_ID_STAGED for staged mode.
+ * 0x52 RW: Number of addresses in the list, up to PUB_MAX_ADDRS
+ * 0x53-0x5E RW: Address list
+ * 0x5F R:  Publish cycles completed (wraps)
+ */
+#include <string.h>
+#include "publish.h"
+#include "can_control.h"
+#include "tick.h"
+
+#define PUB_PERIOD 0
+#define PUB_ID 1
+#define PUB_COUNT 2
+#define PUB_LIST 3
+#define PUB_CYCLES 15
+#define PUB_ID_MASK 0x7FF
+#define PUB_ID_STAGED 0x8000
+
+static uint16_t pub_cache[PUB_HIGH_ADDR-PUB_BASE_ADDR+1];
+static uint16_t pub_wvalue[PUB_HIGH_ADDR-PUB_BASE_ADDR+1];
+
+static struct {
+  uint16_t values[PUB_MAX_ADDRS];
+  uint32_t next_tick; // tick_now() value of the next cycle
+  int cp; // Index of the next value to send
+  int nc; // Number of values sampled this cycle
+} pub;
+
+/**
+ * Samples all of the listed registers at once so each cycle is a
+ * consistent snapshot. Unacknowledged addresses publish as 0.
+ */
+static void pub_sample(void) {
+  int i;
+  pub.nc = pub_cache[PUB_COUNT];
+  for (i = 0; i < pub.nc; ++i) {
+    subbus_peek(pub_cache[PUB_LIST+i], &pub.values[i]);
+  }
+  pub.cp = 0;
+}
+
+/**
+ * Formats the next frame of the current cycle, starting at pub.cp
+ * @param data Buffer of CAN_FD_DLEN bytes
+ * @param nv Set to the number of values in the frame
+ * @return The number of bytes in the frame
+ */
+static int pub_format(uint8_t *data, int *nv) {
+  int max_values =
+    ((can_control_fd() ? CAN_FD_DLEN : CAN_CLASSIC_DLEN) - 1)/2;
+  int i, nb = 0;
+  *nv = pub.nc - pub.cp;
+  if (*nv > max_values) *nv = max_values;
+  data[nb++] = pub.cp;
+  for (i = 0; i < *nv; ++i) {
+    data[nb++] = pub.values[pub.cp+i] & 0xFF;
+    data[nb++] = (pub.values[pub.cp+i] >> 8) & 0xFF;
+  }
+  return nb;
+}
+
+/**
+ * Sends as many frames of the current cycle as the TX FIFO will take.
+ * Frames that do not fit are retried on the next tick.
+ */
+static void pub_send(void) {
+  while (pub.cp < pub.nc) {
+    uint8_t data[CAN_FD_DLEN];
+    int nv, nb;
+    nb = pub_format(data, &nv);
+    if (can_control_write(pub_cache[PUB_ID] & PUB_ID_MASK, data, nb)
+          != ERR_NONE) {
+      return;
+    }
+    pub.cp += nv;
+    if (pub.cp >= pub.nc) {
+      ++pub_cache[PUB_CYCLES];
+    }
+  }
+}
+
+/**
+ * Loads the frames of the current cycle into the dedicated TX buffers.
+ * Remote frames are not answered while the buffers are reloaded, so a
+ * remote frame cannot release a mix of two cycles, and answering only
+ * resumes once every frame of the new cycle is in place. If a buffer's
+ * last frame has not gone out yet, the whole cycle is loaded again on
+ * the next tick.
+ */
+static void pub_stage(void) {
+  uint16_t id = pub_cache[PUB_ID] & PUB_ID_MASK;
+  int frame = 0;
+  bool done;
+  if (pub.nc == 0) return;
+  pub.cp = 0;
+  can_control_set_remote(0, 0);
+  while (pub.cp < pub.nc && frame < CAN_STAGE_BUFFERS) {
+    uint8_t data[CAN_FD_DLEN];
+    int nv, nb;
+    nb = pub_format(data, &nv);
+    if (can_control_stage(frame, id, data, nb) != ERR_NONE) break;
+    pub.cp += nv;
+    ++frame;
+  }
+  done = pub.cp >= pub.nc;
+  if (done) {
+    can_control_set_remote(id, (1 << frame) - 1);
+    ++pub_cache[PUB_CYCLES];
+  }
+  pub.cp = done ? pub.nc : 0;
+}
+
+/**
+ * Stops answering remote frames unless staged mode is active
+ */
+static void pub_remote_update(void) {
+  if (pub_cache[PUB_PERIOD] == 0 || !(pub_cache[PUB_ID] & PUB_ID_STAGED)) {
+    can_control_set_remote(0, 0);
+  }
+}
+
+static void pub_reset(void) {
+  memset(pub_cache, 0, sizeof(pub_cache));
+  pub_cache[PUB_ID] = CAN_ID_BOARD(CAN_BOARD_ID) | CAN_ID_REPLY_BIT |
+                      CAN_PUB_REQID;
+  pub.cp = pub.nc = 0;
+  sb_pub.periodic = false;
+  can_control_set_remote(0, 0);
+}
+
+static void pub_poll(void) {
+  uint32_t now;
+  if (pub_cache[PUB_PERIOD] == 0) return;
+  now = tick_now();
+  if ((int32_t)(now - pub.next_tick) >= 0) {
+    // Stay on the original schedule unless we have fallen a whole
+    // period behind.
+    pub.next_tick += pub_cache[PUB_PERIOD];
+    if ((int32_t)(now - pub.next_tick) >= 0) {
+      pub.next_tick = now + pub_cache[PUB_PERIOD];
+    }
+    pub_sample();
+  }
+  if (pub_cache[PUB_ID] & PUB_ID_STAGED) {
+    if (pub.cp < pub.nc) {
+      pub_stage();
+    }
+  } else {
+    pub_send();
+  }
+}
+
+static void pub_action(void) {
+  uint16_t value;
+  int i;
+  if (subbus_cache_iswritten(&sb_pub, PUB_BASE_ADDR+PUB_ID, &value)) {
+    pub_cache[PUB_ID] = value & (PUB_ID_MASK | PUB_ID_STAGED);
+  }
+  if (subbus_cache_iswritten(&sb_pub, PUB_BASE_ADDR+PUB_COUNT, &value)) {
+    pub_cache[PUB_COUNT] = value > PUB_MAX_ADDRS ? PUB_MAX_ADDRS : value;
+  }
+  for (i = 0; i < PUB_MAX_ADDRS; ++i) {
+    if (subbus_cache_iswritten(&sb_pub, PUB_BASE_ADDR+PUB_LIST+i, &value)) {
+      pub_cache[PUB_LIST+i] = value;
+    }
+  }
+  if (subbus_cache_iswritten(&sb_pub, PUB_BASE_ADDR+PUB_PERIOD, &value)) {
+    pub_cache[PUB_PERIOD] = value;
+    pub.next_tick = tick_now();
+    pub.cp = pub.nc = 0;
+    // Only take the tick when there is something to publish
+    sb_pub.periodic = value != 0;
+  }
+  pub_remote_update();
+}
+
+subbus_driver_t sb_pub = {
+  PUB_BASE_ADDR, PUB_HIGH_ADDR, // address range
+  pub_cache, pub_wvalue,
+  SUBBUS_BITS(PUB_PERIOD, PUB_CYCLES), // readable
+  SUBBUS_BITS(PUB_PERIOD, PUB_LIST+PUB_MAX_ADDRS-1), // writable
+  SUBBUS_BITS(PUB_PERIOD, PUB_LIST+PUB_MAX_ADDRS-1), // dynamic
+  0, 0, // was_read, written
+  pub_reset,
+  pub_poll,
+  pub_action,
+  false
+};
@@ -0,0 +1,13 @@
+#ifndef PUBLISH_H_INCLUDED
+#define PUBLISH_H_INCLUDED
+#include <stdint.h>
+#include "subbus.h"
+
+#define PUB_BASE_ADDR 0x50
+#define PUB_HIGH_ADDR 0x5F
+/** Maximum number of addresses in the publish list */
+#define PUB_MAX_ADDRS 12
+
+extern subbus_driver_t sb_pub;
+
+#endif
@@ -1,57 +1,249 @@
 /* subbus.c for Atmel Studio
  */
+#include <string.h>
+#include <hal_atomic.h>
 #include "subbus.h"
+#if SUBBUS_PROFILE
+#include "prof.h"
+#endif
 
 static subbus_driver_t *drivers[SUBBUS_MAX_DRIVERS];
 static int n_drivers = 0;
+/** Maps each address up to SUBBUS_MAX_ADDR to 1 + its index in
+ *  drivers[], or 0 if unmapped. Addresses above the table are found by
+ *  searching drivers[], as every address was before the table.
+ */
+static uint8_t driver_map[SUBBUS_MAX_ADDR+1];
 
 /** @return true on error.
- * Possible errors include too many drivers or drivers not in ascending order.
+ * Possible errors include too many drivers, drivers whose address range
+ * overlaps one already added, or spanning more than
+ * SUBBUS_MAX_DRIVER_WORDS.
+ * Drivers may be added in any order. drivers[] is kept sorted by
+ * address so reset and poll order do not depend on the order of
+ * registration.
  */
 bool subbus_add_driver(subbus_driver_t *driver) {
-  if ((n_drivers >= SUBBUS_MAX_DRIVERS) ||
-      ((n_drivers > 0) && (drivers[n_drivers-1]->high > driver->low)) ||
-      driver->high < driver->low )
+  uint16_t addr;
+  int i;
+  if (n_drivers >= SUBBUS_MAX_DRIVERS ||
+      driver->high < driver->low ||
+      driver->high - driver->low >= SUBBUS_MAX_DRIVER_WORDS)
     return true;
-  drivers[n_drivers++] = driver;
+  for (i = 0; i < n_drivers; ++i) {
+    if (driver->low <= drivers[i]->high && drivers[i]->low <= driver->high)
+      return true;
+  }
+  for (i = n_drivers; i > 0 && drivers[i-1]->low > driver->low; --i) {
+    drivers[i] = drivers[i-1];
+  }
+  drivers[i] = driver;
+  ++n_drivers;
+  // Indices at and above i have moved, so remap their ranges
+  for ( ; i < n_drivers; ++i) {
+    for (addr = drivers[i]->low;
+         addr <= drivers[i]->high && addr <= SUBBUS_MAX_ADDR; ++addr) {
+      driver_map[addr] = i+1;
+    }
+  }
   return false;
 }
 
+int subbus_n_drivers(void) {
+  return n_drivers;
+}
+
+/**
+ * @param i Index in address order
+ * @return The ith driver, or 0 if i is out of range
+ */
+subbus_driver_t *subbus_get_driver(int i) {
+  return (i >= 0 && i < n_drivers) ? drivers[i] : 0;
+}
+
+/**
+ * @param addr The subbus address
+ * @return The driver serving addr, or 0 if the address is unmapped
+ */
+static subbus_driver_t *subbus_lookup(uint16_t addr) {
+  uint8_t idx;
+  if (addr > SUBBUS_MAX_ADDR) {
+    int i;
+    // drivers[] is sorted, so those reaching past the table come last
+    for (i = n_drivers-1; i >= 0 && drivers[i]->high > SUBBUS_MAX_ADDR; --i) {
+      if (addr >= drivers[i]->low && addr <= drivers[i]->high)
+        return drivers[i];
+    }
+    return 0;
+  }
+  idx = driver_map[addr];
+  return idx ? drivers[idx-1] : 0;
+}
+
+/** Set whenever any driver is marked ready */
+static volatile bool subbus_ready_pending = false;
+
+/**
+ * Requests that the driver's poll function be called on the next
+ * pass of subbus_poll(). Safe to call from interrupt context.
+ * @param drv The driver structure
+ */
+void subbus_mark_ready(subbus_driver_t *drv) {
+  drv->ready = true;
+  subbus_ready_pending = true;
+}
+
+/**
+ * Marks every periodic driver ready. Called from the tick interrupt.
+ */
+void subbus_tick(void) {
+  int i;
+  for (i = 0; i < n_drivers; ++i) {
+    if (drivers[i]->periodic) {
+      subbus_mark_ready(drivers[i]);
+    }
+  }
+}
+
+/**
+ * @return true if any driver has been marked ready since the
+ * last pass of subbus_poll() began.
+ */
+bool subbus_pending(void) {
+  return subbus_ready_pending;
+}
+
+/**
+ * Resets all drivers and marks them all ready so each is polled once.
+ */
 void subbus_reset(void) {
   int i;
   for (i = 0; i < n_drivers; ++i) {
     if (drivers[i]->reset) {
       (*(drivers[i]->reset))();
     }
+    subbus_mark_ready(drivers[i]);
   }
 }
 
+/**
+ * Polls each driver that has been marked ready, clearing its ready
+ * flag first so a wakeup that arrives during the poll is not lost.
+ */
 void subbus_poll(void) {
   int i;
+#if SUBBUS_PROFILE
+  uint32_t loop_start = prof_start();
+  bool polled = false;
+#endif
+  subbus_ready_pending = false;
   for (i = 0; i < n_drivers; ++i) {
-    if (drivers[i]->poll) {
-      (*drivers[i]->poll)();
+    if (drivers[i]->ready) {
+      drivers[i]->ready = false;
+      if (drivers[i]->poll) {
+#if SUBBUS_PROFILE
+        uint32_t start = prof_start();
+        (*drivers[i]->poll)();
+        prof_record(i+1, start);
+        polled = true;
+#else
+        (*drivers[i]->poll)();
+#endif
+      }
     }
   }
+#if SUBBUS_PROFILE
+  if (polled) {
+    prof_record(PROF_LOOP, loop_start);
+  }
+#endif
+}
+
+/**
+ * Returns the cached value at addr without any of the side effects of
+ * subbus_read(): was_read is not set, the driver is not marked ready
+ * and sb_action is not called. Dynamic registers may be stale.
+ * @return true if the address is readable
+ */
+bool subbus_peek(uint16_t addr, uint16_t *rv) {
+  subbus_driver_t *drv = subbus_lookup(addr);
+  if (drv) {
+    uint16_t offset = addr-drv->low;
+    if (drv->readable & SUBBUS_BIT(offset)) {
+      *rv = drv->cache[offset];
+      return true;
+    }
+  }
+  *rv = 0;
+  return false;
+}
+
+/**
+ * Sets was_read flags. subbus_set_read_isr() may set them from interrupt
+ * context, so the read-modify-write is done with interrupts held off.
+ */
+static void subbus_set_read(subbus_driver_t *drv, subbus_mask_t mask) {
+  CRITICAL_SECTION_ENTER()
+  drv->was_read |= mask;
+  CRITICAL_SECTION_LEAVE()
+}
+
+/**
+ * Odd while the main loop is updating a group of cache words that must
+ * be read together. See subbus_cache_begin().
+ */
+static volatile uint16_t subbus_cache_seq = 0;
+
+/**
+ * Fetches a register from interrupt context without side effects. Only
+ * plain cache words are served. A request is answered by checking all
+ * of its addresses with subbus_peek_isr() first and then applying the
+ * reads with subbus_set_read_isr(), so a request that has to be
+ * deferred leaves no trace.
+ * @return false if addr is not readable, is dynamic, or the main loop
+ *   was interrupted between subbus_cache_begin() and subbus_cache_end().
+ *   The caller should then defer to subbus_read() in the main loop.
+ */
+bool subbus_peek_isr(uint16_t addr, uint16_t *rv) {
+  subbus_driver_t *drv = subbus_lookup(addr);
+  if (drv && !(subbus_cache_seq & 1)) {
+    uint16_t offset = addr-drv->low;
+    subbus_mask_t bit = SUBBUS_BIT(offset);
+    if ((drv->readable & bit) && !(drv->dynamic & bit)) {
+      *rv = drv->cache[offset];
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Applies the was_read semantics of subbus_read() from interrupt
+ * context, for an address accepted by subbus_peek_isr()
+ */
+void subbus_set_read_isr(uint16_t addr) {
+  subbus_driver_t *drv = subbus_lookup(addr);
+  if (drv) {
+    drv->was_read |= SUBBUS_BIT(addr-drv->low);
+    subbus_mark_ready(drv);
+  }
 }
 
 /**
  * @return non-zero on success (acknowledge)
  */
 int subbus_read( uint16_t addr, uint16_t *rv ) {
-  int i;
-  for (i = 0; i < n_drivers; ++i) {
-    if (addr < drivers[i]->low) return 0;
-    if (addr <= drivers[i]->high) {
-      uint16_t offset = addr-drivers[i]->low;
-      subbus_cache_word_t *cache = &drivers[i]->cache[offset];
-      if (cache->readable) {
-        *rv = cache->cache;
-        cache->was_read = true;
-        if (cache->dynamic && drivers[i]->sb_action)
-          drivers[i]->sb_action();
-        return 1;
-      }
+  subbus_driver_t *drv = subbus_lookup(addr);
+  if (drv) {
+    uint16_t offset = addr-drv->low;
+    subbus_mask_t bit = SUBBUS_BIT(offset);
+    if (drv->readable & bit) {
+      *rv = drv->cache[offset];
+      subbus_set_read(drv, bit);
+      subbus_mark_ready(drv);
+      if ((drv->dynamic & bit) && drv->sb_action)
+        drv->sb_action();
+      return 1;
     }
   }
   *rv = 0;
@@ -62,24 +254,132 @@ int subbus_read( uint16_t addr, uint16_t *rv ) {
  * @return non-zero on success (acknowledge)
  */
 int subbus_write( uint16_t addr, uint16_t data) {
-  int i;
-  for (i = 0; i < n_drivers; ++i) {
-    if (addr < drivers[i]->low) return 0;
-    if (addr <= drivers[i]->high) {
-      uint16_t offset = addr-drivers[i]->low;
-      subbus_cache_word_t *cache = &drivers[i]->cache[offset];
-      if (cache->writable) {
-        cache->wvalue = data;
-        cache->written = true;
-        if (cache->dynamic && drivers[i]->sb_action)
-          drivers[i]->sb_action();
-        return 1;
-      }
+  subbus_driver_t *drv = subbus_lookup(addr);
+  if (drv) {
+    uint16_t offset = addr-drv->low;
+    subbus_mask_t bit = SUBBUS_BIT(offset);
+    if (drv->writable & bit) {
+      drv->wvalue[offset] = data;
+      drv->written |= bit;
+      subbus_mark_ready(drv);
+      if ((drv->dynamic & bit) && drv->sb_action)
+        drv->sb_action();
+      return 1;
     }
   }
   return 0;
 }
 
+/**
+ * @brief Limits a block transfer to the words served by one driver
+ * @param drv The driver serving addr
+ * @param addr The current address
+ * @param count The number of words remaining in the transfer
+ * @param increment true if the address advances with each word
+ * @return The number of words in this driver's portion of the transfer
+ */
+static uint16_t subbus_block_span(subbus_driver_t *drv, uint16_t addr,
+      uint16_t count, bool increment) {
+  if (increment && count > drv->high - addr + 1)
+    return drv->high - addr + 1;
+  return count;
+}
+
+/**
+ * Reads count words starting at addr into buf, with the same
+ * acknowledge, was_read and sb_action behavior as calling subbus_read()
+ * for each word. Runs of plain cache words (readable and not dynamic)
+ * are copied with a single range check.
+ * @param addr The first address
+ * @param count The number of words to read
+ * @param increment true to read successive addresses, false to read
+ *   addr count times
+ * @param buf Where the words are stored
+ * @return The number of words acknowledged. If less than count, the
+ *   word following the last acknowledged word was not acknowledged.
+ */
+uint16_t subbus_read_block(uint16_t addr, uint16_t count, bool increment,
+                           uint16_t *buf) {
+  uint16_t n = 0;
+  while (n < count) {
+    subbus_driver_t *drv = subbus_lookup(addr);
+    uint16_t offset, nw, i;
+    subbus_mask_t mask;
+    if (!drv) break;
+    offset = addr-drv->low;
+    nw = subbus_block_span(drv, addr, count-n, increment);
+    if (drv->read_block) {
+      i = drv->read_block(addr, nw, increment, &buf[n]);
+      n += i;
+      if (i < nw) break;
+    } else {
+      mask = increment ? SUBBUS_BITS(offset, offset+nw-1) : SUBBUS_BIT(offset);
+      if ((drv->readable & mask) == mask && !(drv->dynamic & mask)) {
+        if (increment) {
+          memcpy(&buf[n], &drv->cache[offset], nw*sizeof(uint16_t));
+        } else {
+          for (i = 0; i < nw; ++i)
+            buf[n+i] = drv->cache[offset];
+        }
+        subbus_set_read(drv, mask);
+        subbus_mark_ready(drv);
+        n += nw;
+      } else {
+        for (i = 0; i < nw; ++i) {
+          if (!subbus_read(increment ? addr+i : addr, &buf[n]))
+            return n;
+          ++n;
+        }
+      }
+    }
+    if (increment) addr += nw;
+  }
+  return n;
+}
+
+/**
+ * Writes count words from buf starting at addr, with the same
+ * acknowledge, written and sb_action behavior as calling subbus_write()
+ * for each word.
+ * @param addr The first address
+ * @param count The number of words to write
+ * @param increment true to write successive addresses, false to write
+ *   each word to addr
+ * @param buf The words to write
+ * @return The number of words acknowledged
+ */
+uint16_t subbus_write_block(uint16_t addr, uint16_t count, bool increment,
+                            const uint16_t *buf) {
+  uint16_t n = 0;
+  while (n < count) {
+    subbus_driver_t *drv = subbus_lookup(addr);
+    uint16_t offset, nw, i;
+    subbus_mask_t mask;
+    if (!drv) break;
+    offset = addr-drv->low;
+    nw = subbus_block_span(drv, addr, count-n, increment);
+    mask = increment ? SUBBUS_BITS(offset, offset+nw-1) : SUBBUS_BIT(offset);
+    if ((drv->writable & mask) == mask && !(drv->dynamic & mask)) {
+      if (increment) {
+        memcpy(&drv->wvalue[offset], &buf[n], nw*sizeof(uint16_t));
+      } else {
+        drv->wvalue[offset] = buf[n+nw-1];
+      }
+      drv->written |= mask;
+      subbus_mark_ready(drv);
+      n += nw;
+    } else {
+      for (i = 0; i < nw; ++i) {
+        if (!subbus_write(increment ? addr+i : addr, buf[n]))
+          return n;
+        ++n;
+      }
+    }
+    if (increment) addr += nw;
+  }
+  return n;
+}
+
 void set_fail(uint16_t arg) {
 #if defined(SUBBUS_FAIL_ADDR)
   subbus_write(SUBBUS_FAIL_ADDR, arg);
@@ -87,42 +387,211 @@ void set_fail(uint16_t arg) {
 }
 
 #if SUBBUS_INTERRUPTS
-extern volatile uint8_t subbus_intr_req;
-void init_interrupts(void);
-int intr_attach(int id, uint16_t addr);
-int intr_detach( uint16_t addr );
-void intr_service(void);
+#define SB_BASE_INTA_BIT SUBBUS_BIT(SUBBUS_INTA_ADDR)
+#else
+#define SB_BASE_INTA_BIT 0
 #endif
 
-static subbus_cache_word_t sb_base_cache[SUBBUS_INSTID_ADDR+1] = {
-  { 0, 0, 0, 0, 0, 0, 0 }, // Reserved zero address
-  { 0, 0, 0, 0, 0, 0, 0} , // INTA
-  { SUBBUS_BOARD_ID, 0, 1, 0, 0, 0, 0 },  // Board ID (SUBBUS_BDID_ADDR)
-  { SUBBUS_BOARD_BUILD_NUM, 0, 1, 0, 0, 0, 0 }, // Build number (SUBBUS_BLDNO_ADDR)
-  { SUBBUS_BOARD_SN, 0, 1, 0, 0, 0, 0 }, // Build number (SUBBUS_BDSN_ADDR)
-  { SUBBUS_BOARD_INSTRUMENT_ID, 0, 1, 0, 0, 0, 0 } // Build number (SUBBUS_BDSN_ADDR)
+static uint16_t sb_base_cache[SUBBUS_INSTID_ADDR+1] = {
+  0, // Reserved zero address
+  0, // INTA
+  SUBBUS_BOARD_ID,            // Board ID (SUBBUS_BDID_ADDR)
+  SUBBUS_BOARD_BUILD_NUM,     // Build number (SUBBUS_BLDNO_ADDR)
+  SUBBUS_BOARD_SN,            // Serial number (SUBBUS_BDSN_ADDR)
+  SUBBUS_BOARD_INSTRUMENT_ID  // Instrument ID (SUBBUS_INSTID_ADDR)
 };
 
-subbus_driver_t sb_base = { 0, SUBBUS_INSTID_ADDR, sb_base_cache, 0, 0, 0, false };
+#if SUBBUS_INTERRUPTS
+/**
+ * Reading INTA acknowledges the interrupts it reports. Since this runs
+ * immediately after the read, only the bits the host saw are cleared.
+ */
+static void sb_base_action(void) {
+  if (sb_base.was_read & SB_BASE_INTA_BIT) {
+    subbus_cache_clear_read(&sb_base, SB_BASE_INTA_BIT);
+    sb_base_cache[SUBBUS_INTA_ADDR] = 0;
+  }
+}
+#else
+#define sb_base_action 0
+#endif
 
-static subbus_cache_word_t sb_fail_sw_cache[SUBBUS_SWITCHES_ADDR-SUBBUS_FAIL_ADDR+1] = {
-  { 0, 0, 1, 0, 1, 0, 0 }, // Fail Register
-  { 0, 0, 1, 0, 0, 0, 0 }  // Switches
-};
+subbus_driver_t sb_base = { 0, SUBBUS_INSTID_ADDR, sb_base_cache, 0,
+  SUBBUS_BITS(SUBBUS_BDID_ADDR, SUBBUS_INSTID_ADDR) | SB_BASE_INTA_BIT, 0,
+  SB_BASE_INTA_BIT, 0, 0,
+  0, 0, sb_base_action, false };
+
+#if SUBBUS_INTERRUPTS
+volatile uint8_t subbus_intr_req = 0;
+
+static struct {
+  uint16_t addr;
+  uint8_t id;
+  bool attached;
+} intr_table[SUBBUS_MAX_INTERRUPTS];
+
+static bool (*intr_notify[SUBBUS_MAX_NOTIFY])(uint16_t inta);
+static int intr_n_notify = 0;
+static uint8_t intr_notify_pending = 0; // Bit i: intr_notify[i] not yet called
+
+/**
+ * Registers a transport function that tells the host which interrupts
+ * are pending. Every registered transport is notified. Registering the
+ * same function again has no effect.
+ * @param notify Called with the INTA value. Returns true if the
+ *   notification was sent, false to retry on a later intr_service().
+ */
+void subbus_intr_add_notify(bool (*notify)(uint16_t inta)) {
+  int i;
+  for (i = 0; i < intr_n_notify; ++i) {
+    if (intr_notify[i] == notify) return;
+  }
+  if (intr_n_notify < SUBBUS_MAX_NOTIFY) {
+    intr_notify[intr_n_notify++] = notify;
+  }
+}
+
+void init_interrupts(void) {
+  int i;
+  for (i = 0; i < SUBBUS_MAX_INTERRUPTS; ++i) {
+    intr_table[i].attached = false;
+  }
+  sb_base_cache[SUBBUS_INTA_ADDR] = 0;
+  intr_notify_pending = 0;
+  subbus_intr_req = 0;
+}
+
+/**
+ * Attaches an interrupt to the specified address. When the driver
+ * serving addr raises an interrupt, bit id is set in INTA and the
+ * host is notified.
+ * @param id The interrupt bit in INTA, 0-15
+ * @param addr An address served by some driver
+ * @return non-zero on success
+ */
+int intr_attach(int id, uint16_t addr) {
+  int i, free_slot = -1;
+  if (id < 0 || id > 15 || subbus_lookup(addr) == 0) return 0;
+  for (i = 0; i < SUBBUS_MAX_INTERRUPTS; ++i) {
+    if (intr_table[i].attached) {
+      if (intr_table[i].addr == addr) {
+        intr_table[i].id = id;
+        return 1;
+      }
+    } else if (free_slot < 0) {
+      free_slot = i;
+    }
+  }
+  if (free_slot < 0) return 0;
+  intr_table[free_slot].addr = addr;
+  intr_table[free_slot].id = id;
+  intr_table[free_slot].attached = true;
+  return 1;
+}
+
+/**
+ * @param addr The address passed to intr_attach()
+ * @return non-zero if an interrupt was attached to addr
+ */
+int intr_detach( uint16_t addr ) {
+  int i;
+  for (i = 0; i < SUBBUS_MAX_INTERRUPTS; ++i) {
+    if (intr_table[i].attached && intr_table[i].addr == addr) {
+      intr_table[i].attached = false;
+      sb_base_cache[SUBBUS_INTA_ADDR] &= ~(1 << intr_table[i].id);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Called by drivers when the condition behind addr requires the host's
+ * attention. Does nothing if no interrupt is attached to addr or if the
+ * interrupt is already pending.
+ * @param addr The address the host attached to
+ */
+void subbus_intr_raise(uint16_t addr) {
+  int i;
+  for (i = 0; i < SUBBUS_MAX_INTERRUPTS; ++i) {
+    if (intr_table[i].attached && intr_table[i].addr == addr) {
+      uint16_t bit = 1 << intr_table[i].id;
+      if (!(sb_base_cache[SUBBUS_INTA_ADDR] & bit)) {
+        sb_base_cache[SUBBUS_INTA_ADDR] |= bit;
+        intr_notify_pending = (1 << intr_n_notify) - 1;
+        subbus_intr_req = 1;
+        subbus_ready_pending = true;
+      }
+    }
+  }
+}
+
+/**
+ * Sends the pending INTA value to the host. If a transport cannot
+ * accept it now, subbus_intr_req stays set and we try that transport
+ * again later.
+ */
+void intr_service(void) {
+  int i;
+  for (i = 0; i < intr_n_notify; ++i) {
+    if ((intr_notify_pending & (1 << i)) &&
+        intr_notify[i](sb_base_cache[SUBBUS_INTA_ADDR])) {
+      intr_notify_pending &= ~(1 << i);
+    }
+  }
+  if (intr_notify_pending == 0)
+    subbus_intr_req = 0;
+}
+
+static uint16_t sb_intr_cache[SUBBUS_INTR_DETACH_ADDR-SUBBUS_INTR_ATTACH_ADDR+1];
+static uint16_t sb_intr_wvalue[SUBBUS_INTR_DETACH_ADDR-SUBBUS_INTR_ATTACH_ADDR+1];
+
+/**
+ * 0x0A W: Attach. Value is (id<<8) | addr
+ * 0x0B W: Detach. Value is addr
+ * These allow hosts without the serial 'i' and 'u' commands, i.e. over
+ * CAN, to attach interrupts.
+ */
+static void sb_intr_action(void) {
+  uint16_t value;
+  if (subbus_cache_iswritten(&sb_intr, SUBBUS_INTR_ATTACH_ADDR, &value)) {
+    intr_attach(value >> 8, value & 0xFF);
+  }
+  if (subbus_cache_iswritten(&sb_intr, SUBBUS_INTR_DETACH_ADDR, &value)) {
+    intr_detach(value);
+  }
+}
+
+subbus_driver_t sb_intr = { SUBBUS_INTR_ATTACH_ADDR, SUBBUS_INTR_DETACH_ADDR,
+  sb_intr_cache, sb_intr_wvalue,
+  0, SUBBUS_BITS(0,1), SUBBUS_BITS(0,1), 0, 0,
+  init_interrupts, 0, sb_intr_action, false };
+#endif
+
+#define SB_FAIL_BIT SUBBUS_BIT(0) // Fail Register is writable, Switches is not
+static uint16_t sb_fail_sw_cache[SUBBUS_SWITCHES_ADDR-SUBBUS_FAIL_ADDR+1];
+static uint16_t sb_fail_sw_wvalue[SUBBUS_SWITCHES_ADDR-SUBBUS_FAIL_ADDR+1];
 
 static void sb_fail_sw_reset() {
-  sb_fail_sw_cache[0].cache = 0;
+  sb_fail_sw_cache[0] = 0;
 }
 
 static void sb_fail_sw_poll() {
-  if (sb_fail_sw_cache[0].written) {
-    sb_fail_sw_cache[0].cache = sb_fail_sw_cache[0].wvalue;
-    sb_fail_sw_cache[0].written = false;
+  if (sb_fail_sw.written & SB_FAIL_BIT) {
+    sb_fail_sw_cache[0] = sb_fail_sw_wvalue[0];
+    sb_fail_sw.written &= ~SB_FAIL_BIT;
+#if SUBBUS_INTERRUPTS
+    if (sb_fail_sw_cache[0]) {
+      subbus_intr_raise(SUBBUS_FAIL_ADDR);
+    }
+#endif
   }
 }
 
 subbus_driver_t sb_fail_sw = { SUBBUS_FAIL_ADDR, SUBBUS_SWITCHES_ADDR,
-    sb_fail_sw_cache, sb_fail_sw_reset, sb_fail_sw_poll, 0, false };
+    sb_fail_sw_cache, sb_fail_sw_wvalue,
+    SUBBUS_BITS(0, SUBBUS_SWITCHES_ADDR-SUBBUS_FAIL_ADDR), SB_FAIL_BIT, 0, 0, 0,
+    sb_fail_sw_reset, sb_fail_sw_poll, 0, false };
 
 
 /**
@@ -135,16 +604,50 @@ subbus_driver_t sb_fail_sw = { SUBBUS_FAIL_ADDR, SUBBUS_SWITCHES_ADDR,
  */
 bool subbus_cache_iswritten(subbus_driver_t *drv, uint16_t addr, uint16_t *value) {
   if (addr >= drv->low && addr <= drv->high) {
-    subbus_cache_word_t *word = &drv->cache[addr-drv->low];
-    if (word->writable && word->written) {
-      *value = word->wvalue;
-      word->written = false;
+    uint16_t offset = addr-drv->low;
+    subbus_mask_t bit = SUBBUS_BIT(offset);
+    if (drv->writable & drv->written & bit) {
+      *value = drv->wvalue[offset];
+      drv->written &= ~bit;
       return true;
     }
   }
   return false;
 }
 
+/**
+ * Like subbus_cache_iswritten(), but reports the lowest written
+ * address in the driver's range, so a poll routine can drain all
+ * pending writes without testing each word.
+ * @param drv The driver structure
+ * @param addr Pointer where the written address may be stored
+ * @param value Pointer where the written value may be stored
+ * @return true if any word has been written
+ */
+bool subbus_cache_next_written(subbus_driver_t *drv, uint16_t *addr, uint16_t *value) {
+  subbus_mask_t pending = drv->writable & drv->written;
+  if (pending) {
+    uint16_t offset = __builtin_ctz(pending);
+    drv->written &= ~SUBBUS_BIT(offset);
+    *addr = drv->low + offset;
+    *value = drv->wvalue[offset];
+    return true;
+  }
+  return false;
+}
+
+static void (*cache_monitor)(uint16_t addr, uint16_t data) = 0;
+
+/**
+ * Registers a function to be called with every value stored by
+ * subbus_cache_update(), e.g. for change-of-value reporting.
+ * Must not be called from interrupt context.
+ * @param monitor The function, or 0 to remove it
+ */
+void subbus_cache_set_monitor(void (*monitor)(uint16_t addr, uint16_t data)) {
+  cache_monitor = monitor;
+}
+
 /**
  * This function differs from subbus_write() in that it directly
  * updates the cache value. subbus_write() is specifically for
@@ -159,10 +662,14 @@ bool subbus_cache_iswritten(subbus_driver_t *drv, uint16_t addr, uint16_t *value
  */
 bool subbus_cache_update(subbus_driver_t *drv, uint16_t addr, uint16_t data) {
   if (addr >= drv->low && addr <= drv->high) {
-    subbus_cache_word_t *word = &drv->cache[addr-drv->low];
-    if (word->readable) {
-      word->cache = data;
-      word->was_read = false;
+    uint16_t offset = addr-drv->low;
+    subbus_mask_t bit = SUBBUS_BIT(offset);
+    if (drv->readable & bit) {
+      drv->cache[offset] = data;
+      subbus_cache_clear_read(drv, bit);
+      if (cache_monitor) {
+        cache_monitor(addr, data);
+      }
       return true;
     }
   }
@@ -171,8 +678,43 @@ bool subbus_cache_update(subbus_driver_t *drv, uint16_t addr, uint16_t data) {
 
 bool subbus_cache_was_read(subbus_driver_t *drv, uint16_t addr) {
   if (addr >= drv->low && addr <= drv->high) {
-    subbus_cache_word_t *word = &drv->cache[addr-drv->low];
-    return word->was_read;
+    return (drv->was_read & SUBBUS_BIT(addr-drv->low)) != 0;
   }
   return false;
 }
+
+/**
+ * @param drv The driver structure
+ * @param mask The set of words to check, e.g. SUBBUS_BITS(1,4)
+ * @return true if every word in mask has been read
+ */
+bool subbus_cache_all_read(subbus_driver_t *drv, subbus_mask_t mask) {
+  return (drv->was_read & mask) == mask;
+}
+
+/**
+ * @param drv The driver structure
+ * @param mask The set of words whose was_read flags are to be cleared
+ */
+void subbus_cache_clear_read(subbus_driver_t *drv, subbus_mask_t mask) {
+  CRITICAL_SECTION_ENTER()
+  drv->was_read &= ~mask;
+  CRITICAL_SECTION_LEAVE()
+}
+
+/**
+ * Brackets a group of subbus_cache_update() calls that belong together,
+ * such as a reading and its count, so subbus_peek_isr() never returns
+ * some words from before the group and some from after. Groups may not
+ * be nested. Main loop only.
+ */
+void subbus_cache_begin(void) {
+  ++subbus_cache_seq;
+}
+
+/**
+ * Ends a group started by subbus_cache_begin()
+ */
+void subbus_cache_end(void) {
+  ++subbus_cache_seq;
+}
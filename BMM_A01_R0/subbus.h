@@ -18,8 +18,24 @@
 #define SUBBUS_SWITCHES_ADDR        0x0007
 #define SUBBUS_DESC_FIFO_SIZE_ADDR  0x0008
 #define SUBBUS_DESC_FIFO_ADDR       0x0009
-#define SUBBUS_MAX_DRIVERS          6
-#define SUBBUS_INTERRUPTS           0
+#define SUBBUS_INTR_ATTACH_ADDR     0x000A
+#define SUBBUS_INTR_DETACH_ADDR     0x000B
+/** Capacity of the driver registry. Drivers may be added in any order */
+#define SUBBUS_MAX_DRIVERS          32
+/** Highest address served through the dispatch table. Drivers may
+ *  still sit above it, but those addresses are found by searching the
+ *  drivers, so keep frequently read registers below it.
+ */
+#define SUBBUS_MAX_ADDR             0xFF
+#define SUBBUS_INTERRUPTS           1
+/** Number of addresses that may have an interrupt attached */
+#define SUBBUS_MAX_INTERRUPTS       8
+/** Number of transports that can notify the host of interrupts */
+#define SUBBUS_MAX_NOTIFY           2
+/** Set to time each driver's poll. See prof.c */
+#ifndef SUBBUS_PROFILE
+#define SUBBUS_PROFILE              1
+#endif
 
 #define SUBBUS_ADDR_CMDS 0x18
 
@@ -29,46 +45,92 @@ void init_interrupts(void);
 int intr_attach(int id, uint16_t addr);
 int intr_detach( uint16_t addr );
 void intr_service(void);
+void subbus_intr_raise(uint16_t addr);
+void subbus_intr_add_notify(bool (*notify)(uint16_t inta));
 #endif
 int subbus_read( uint16_t addr, uint16_t *rv );
+bool subbus_peek(uint16_t addr, uint16_t *rv);
+bool subbus_peek_isr(uint16_t addr, uint16_t *rv);
+void subbus_set_read_isr(uint16_t addr);
 int subbus_write( uint16_t addr, uint16_t data);
+uint16_t subbus_read_block(uint16_t addr, uint16_t count, bool increment,
+                          uint16_t *buf);
+uint16_t subbus_write_block(uint16_t addr, uint16_t count, bool increment,
+                           const uint16_t *buf);
 void subbus_reset(void);
 void subbus_poll(void);
 void set_fail(uint16_t arg);
 
-typedef struct {
-  /** The current value of this word */
-  uint16_t cache;
-  /** The value that has been written. Allows the driver code to do checks for validity */
-  uint16_t wvalue;
-  /** True if this word is readable */
-  bool readable;
-  /** True if this word has been read */
-  bool was_read;
-  /** True if this word is writable */
-  bool writable;
-  /** True if this word has been written */
-  bool written;
-  /** True to invoke sb_action immediately rather than waiting for poll */
-  bool dynamic;
-} subbus_cache_word_t;
+/**
+ * Bitmap over the words of a single driver. Bit n corresponds to
+ * address low+n, so a driver may span at most SUBBUS_MAX_DRIVER_WORDS.
+ */
+typedef uint32_t subbus_mask_t;
+#define SUBBUS_MAX_DRIVER_WORDS 32
+/** The mask bit for the word at offset from the driver's low address */
+#define SUBBUS_BIT(offset) (((subbus_mask_t)1)<<(offset))
+/** The mask for offsets first through last inclusive */
+#define SUBBUS_BITS(first,last) \
+    ((~(subbus_mask_t)0 >> (31-((last)-(first)))) << (first))
 
 typedef struct {
   uint16_t low, high;
-  subbus_cache_word_t *cache;
+  /** The current value of each word */
+  uint16_t *cache;
+  /** The values that have been written. Allows the driver code to do
+   *  checks for validity. May be 0 if no word is writable.
+   */
+  uint16_t *wvalue;
+  /** Words that are readable */
+  subbus_mask_t readable;
+  /** Words that are writable */
+  subbus_mask_t writable;
+  /** Words that invoke sb_action immediately rather than waiting for poll */
+  subbus_mask_t dynamic;
+  /** Words that have been read */
+  subbus_mask_t was_read;
+  /** Words that have been written */
+  subbus_mask_t written;
   void (*reset)(void);
   void (*poll)(void);
   void (*sb_action)(void); // called if dynamic
   bool initialized;
+  /** Optional. Serves the portion of subbus_read_block() that falls
+   *  within this driver's range, with the same readable, was_read and
+   *  sb_action semantics as subbus_read().
+   *  @return The number of words acknowledged
+   */
+  uint16_t (*read_block)(uint16_t addr, uint16_t count, bool increment,
+                         uint16_t *buf);
+  /** True to mark this driver ready on every tick */
+  bool periodic;
+  /** True if poll should be called on the next pass of subbus_poll().
+   *  Set by subbus_mark_ready(), subbus_read() and subbus_write().
+   */
+  volatile bool ready;
 } subbus_driver_t;
 
 bool subbus_add_driver(subbus_driver_t *driver);
+int subbus_n_drivers(void);
+subbus_driver_t *subbus_get_driver(int i);
+void subbus_mark_ready(subbus_driver_t *drv);
+void subbus_tick(void);
+bool subbus_pending(void);
 extern subbus_driver_t sb_base;
 extern subbus_driver_t sb_fail_sw;
+#if SUBBUS_INTERRUPTS
+extern subbus_driver_t sb_intr;
+#endif
 
 bool subbus_cache_iswritten(subbus_driver_t *drv, uint16_t addr, uint16_t *value);
 bool subbus_cache_was_read(subbus_driver_t *drv, uint16_t addr);
 bool subbus_cache_update(subbus_driver_t *drv, uint16_t addr, uint16_t data);
+bool subbus_cache_all_read(subbus_driver_t *drv, subbus_mask_t mask);
+void subbus_cache_clear_read(subbus_driver_t *drv, subbus_mask_t mask);
+bool subbus_cache_next_written(subbus_driver_t *drv, uint16_t *addr, uint16_t *value);
+void subbus_cache_set_monitor(void (*monitor)(uint16_t addr, uint16_t data));
+void subbus_cache_begin(void);
+void subbus_cache_end(void);
 
 #endif // USE_SUBBUS
 
@@ -0,0 +1,41 @@
+/** @file tick.c
+ * Millisecond timebase from SysTick. Each tick marks the periodic
+ * subbus drivers ready, so they run even when no interrupt has
+ * flagged new work for them.
+ */
+#include "driver_init.h"
+#include "subbus.h"
+#include "tick.h"
+
+static volatile uint32_t tick_count = 0;
+
+void SysTick_Handler(void) {
+  ++tick_count;
+  subbus_tick();
+}
+
+void tick_init(void) {
+  SysTick_Config(TICK_CYCLES);
+}
+
+/**
+ * @return Ticks since tick_init(). Wraps after 2^32 ticks.
+ */
+uint32_t tick_now(void) {
+  return tick_count;
+}
+
+/**
+ * @return CPU cycles since tick_init(), modulo 2^32. Differences of
+ * two values are valid for intervals under 2^32 cycles. Not for use
+ * from interrupt handlers that can preempt SysTick_Handler. The retry
+ * loop catches a tick that lands between the two reads.
+ */
+uint32_t tick_cycles(void) {
+  uint32_t ticks, val;
+  do {
+    ticks = tick_count;
+    val = SysTick->VAL;
+  } while (ticks != tick_count);
+  return ticks*TICK_CYCLES + (TICK_CYCLES-1-val);
+}
@@ -0,0 +1,16 @@
+#ifndef TICK_H_INCLUDED
+#define TICK_H_INCLUDED
+#include <stdint.h>
+#include <peripheral_clk_config.h>
+
+/** Rate of the SysTick interrupt that drives periodic subbus drivers */
+#define TICK_RATE_HZ 1000
+/** CPU cycles per tick */
+#define TICK_CYCLES (CONF_CPU_FREQUENCY/TICK_RATE_HZ)
+#define TICK_CYCLES_PER_US (CONF_CPU_FREQUENCY/1000000)
+
+void tick_init(void);
+uint32_t tick_now(void);
+uint32_t tick_cycles(void);
+
+#endif
@@ -0,0 +1,115 @@
+/** @file bench_subbus.c
+ * Host micro-benchmark of subbus read dispatch. Registers up to
+ * SUBBUS_MAX_DRIVERS dummy 4-word drivers and, as each group is added,
+ * times subbus_read() through the address table against the linear
+ * walk of the sorted drivers that subbus_read() used before the table.
+ * Both paths do the same per-word work, so the difference is the
+ * cost of finding the driver.
+ *
+ *   make bench
+ *   ./bench_subbus [reads per count]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <hal_atomic.h>
+#include "subbus.h"
+
+#define BENCH_DRIVER_WORDS 4
+#define BENCH_STRIDE 7
+#define BENCH_BASE 0x10
+
+static subbus_driver_t bench_drivers[SUBBUS_MAX_DRIVERS];
+static int bench_n_drivers = 0;
+static uint16_t bench_cache[SUBBUS_MAX_DRIVERS][BENCH_DRIVER_WORDS];
+static uint16_t bench_addrs[SUBBUS_MAX_DRIVERS*BENCH_DRIVER_WORDS];
+static volatile uint16_t bench_sink;
+
+/** The driver search subbus_read() did before the dispatch table */
+static int bench_scan_read(uint16_t addr, uint16_t *rv) {
+  int i;
+  for (i = 0; i < bench_n_drivers; ++i) {
+    subbus_driver_t *drv = &bench_drivers[i];
+    if (addr < drv->low) break;
+    if (addr <= drv->high) {
+      uint16_t offset = addr-drv->low;
+      subbus_mask_t bit = SUBBUS_BIT(offset);
+      if (drv->readable & bit) {
+        *rv = drv->cache[offset];
+        CRITICAL_SECTION_ENTER()
+        drv->was_read |= bit;
+        CRITICAL_SECTION_LEAVE()
+        subbus_mark_ready(drv);
+        if ((drv->dynamic & bit) && drv->sb_action)
+          drv->sb_action();
+        return 1;
+      }
+    }
+  }
+  *rv = 0;
+  return 0;
+}
+
+static double bench_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/** @return Mean ns per read of the n_addrs registered addresses */
+static double bench_run(int (*read)(uint16_t, uint16_t *), int n_addrs,
+                        long reads) {
+  double start;
+  long i;
+  int j = 0;
+  uint16_t rv;
+  start = bench_ns();
+  for (i = 0; i < reads; ++i) {
+    read(bench_addrs[j], &rv);
+    bench_sink = rv;
+    if (++j == n_addrs) j = 0;
+  }
+  return (bench_ns() - start) / reads;
+}
+
+/** Sets up and registers the next dummy driver */
+static bool bench_add_driver(void) {
+  subbus_driver_t *drv = &bench_drivers[bench_n_drivers];
+  drv->low = BENCH_BASE + BENCH_STRIDE*bench_n_drivers;
+  drv->high = drv->low + BENCH_DRIVER_WORDS - 1;
+  drv->cache = bench_cache[bench_n_drivers];
+  drv->readable = SUBBUS_BITS(0, BENCH_DRIVER_WORDS-1);
+  if (subbus_add_driver(drv)) {
+    return true;
+  }
+  ++bench_n_drivers;
+  return false;
+}
+
+int main(int argc, char **argv) {
+  long reads = argc > 1 ? atol(argv[1]) : 10000000;
+  int n_addrs = 0;
+  if (reads <= 0) {
+    fprintf(stderr, "usage: %s [reads per count]\n", argv[0]);
+    return 2;
+  }
+  printf("drivers  table ns/read  scan ns/read\n");
+  while (bench_n_drivers < SUBBUS_MAX_DRIVERS) {
+    int k, n;
+    if (bench_add_driver()) {
+      fprintf(stderr, "subbus_add_driver() failed for driver %d\n",
+        bench_n_drivers);
+      return 1;
+    }
+    for (k = 0; k < BENCH_DRIVER_WORDS; ++k) {
+      bench_addrs[n_addrs++] = bench_drivers[bench_n_drivers-1].low + k;
+    }
+    n = bench_n_drivers;
+    if ((n & (n-1)) == 0 || n == SUBBUS_MAX_DRIVERS) {
+      double table = bench_run(subbus_read, n_addrs, reads);
+      double scan = bench_run(bench_scan_read, n_addrs, reads);
+      printf("%7d  %13.2f  %12.2f\n", n, table, scan);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,52 @@
+/** @file compiler.h
+ * Host replacement. Uses the ASF compiler.h in its unit test mode,
+ * which leaves out the device headers, and supplies the few CMSIS and
+ * SAMC21 definitions the firmware sources use directly.
+ */
+#ifndef SIM_COMPILER_H_INCLUDED
+#define SIM_COMPILER_H_INCLUDED
+
+#ifndef _UNIT_TEST_
+#define _UNIT_TEST_
+#endif
+#include_next <compiler.h>
+
+/* CMSIS core. Interrupt masking is simulated by sim_irq.c and sleep by
+ * sim_clock.c. */
+void __disable_irq(void);
+void __enable_irq(void);
+void sim_wfi(void);
+#define __WFI() sim_wfi()
+
+typedef struct {
+	volatile uint32_t CTRL;
+	volatile uint32_t LOAD;
+	volatile uint32_t VAL;
+	volatile uint32_t CALIB;
+} SysTick_Type;
+SysTick_Type *sim_systick(void);
+#define SysTick (sim_systick())
+uint32_t SysTick_Config(uint32_t ticks);
+void     SysTick_Handler(void);
+
+/* Peripheral instances are only used as handles */
+#define SERCOM0 ((void *)0x42000400)
+#define SERCOM3 ((void *)0x42001000)
+#define CAN1 ((void *)0x42002000)
+
+/* SERCOM I2C master registers written by i2c.c on a bus error */
+#define SERCOM_I2CM_STATUS_BUSERR (1u << 0)
+
+static inline void hri_sercomi2cm_write_STATUS_reg(const void *const hw, uint16_t data)
+{
+	(void)hw;
+	(void)data;
+}
+
+static inline void hri_sercomi2cm_clear_INTFLAG_reg(const void *const hw, uint8_t mask)
+{
+	(void)hw;
+	(void)mask;
+}
+
+#endif /* SIM_COMPILER_H_INCLUDED */
@@ -0,0 +1,7 @@
+/** @file hpl_gclk_base.h
+ * Host replacement. Peripheral clocks need no setup in the simulation.
+ */
+#ifndef _HPL_GCLK_BASE_H_INCLUDED
+#define _HPL_GCLK_BASE_H_INCLUDED
+
+#endif /* _HPL_GCLK_BASE_H_INCLUDED */
@@ -0,0 +1,49 @@
+/** @file hpl_gpio_base.h
+ * Host replacement for the SAMC21 PORT implementation of the GPIO HPL.
+ * Pin levels live in sim_gpio.c, where the script can drive inputs and
+ * output changes are logged.
+ */
+#ifndef _HPL_GPIO_BASE_H_INCLUDED
+#define _HPL_GPIO_BASE_H_INCLUDED
+
+void     sim_gpio_set_direction(enum gpio_port port, uint32_t mask, enum gpio_direction direction);
+void     sim_gpio_set_level(enum gpio_port port, uint32_t mask, bool level);
+uint32_t sim_gpio_get_level(enum gpio_port port);
+
+static inline void _gpio_set_direction(const enum gpio_port port, const uint32_t mask,
+                                       const enum gpio_direction direction)
+{
+	sim_gpio_set_direction(port, mask, direction);
+}
+
+static inline void _gpio_set_level(const enum gpio_port port, const uint32_t mask, const bool level)
+{
+	sim_gpio_set_level(port, mask, level);
+}
+
+static inline void _gpio_toggle_level(const enum gpio_port port, const uint32_t mask)
+{
+	sim_gpio_set_level(port, mask & ~sim_gpio_get_level(port), true);
+	sim_gpio_set_level(port, mask & sim_gpio_get_level(port), false);
+}
+
+static inline uint32_t _gpio_get_level(const enum gpio_port port)
+{
+	return sim_gpio_get_level(port);
+}
+
+static inline void _gpio_set_pin_pull_mode(const enum gpio_port port, const uint8_t pin,
+                                           const enum gpio_pull_mode pull_mode)
+{
+	(void)port;
+	(void)pin;
+	(void)pull_mode;
+}
+
+static inline void _gpio_set_pin_function(const uint32_t gpio, const uint32_t function)
+{
+	(void)gpio;
+	(void)function;
+}
+
+#endif /* _HPL_GPIO_BASE_H_INCLUDED */
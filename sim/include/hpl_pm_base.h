@@ -0,0 +1,8 @@
+/** @file hpl_pm_base.h
+ * Host replacement. Peripheral bus clocks need no setup in the
+ * simulation.
+ */
+#ifndef _HPL_PM_BASE_H_INCLUDED
+#define _HPL_PM_BASE_H_INCLUDED
+
+#endif /* _HPL_PM_BASE_H_INCLUDED */
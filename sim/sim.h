@@ -0,0 +1,75 @@
+/** @file sim.h
+ * Interfaces shared by the pieces of the host simulation. The firmware
+ * sources are compiled unchanged against the mock HAL in sim_*.c, and
+ * sim_host.c plays the part of the CAN host, the serial terminal and
+ * the analog world described by a script.
+ */
+#ifndef SIM_H_INCLUDED
+#define SIM_H_INCLUDED
+#include <stdint.h>
+#include <stdbool.h>
+#include <hal_atomic.h>
+
+/* sim_irq.c */
+#define SIM_IRQ_MAX 8
+void sim_irq_raise(void (*handler)(void));
+bool sim_irq_in_handler(void);
+bool sim_irq_pending(void);
+
+/* sim_clock.c */
+#define SIM_NS_PER_MS 1000000ULL
+typedef void (*sim_event_fn)(void *arg);
+uint64_t sim_host_ns(void);
+uint64_t sim_now_ns(void);
+void sim_clock_update(void);
+void sim_event_at(uint64_t t, sim_event_fn fn, void *arg);
+void sim_event_cancel(sim_event_fn fn, void *arg);
+void sim_loop_begin(void);
+void sim_loop_idle(void);
+void sim_busy_until(uint64_t t);
+void sim_busy_run(void);
+uint64_t sim_loop_iterations(void);
+uint64_t sim_loop_worst_ns(void);
+uint64_t sim_loop_busy_ns(void);
+
+/* sim_can.c */
+#define SIM_CAN_CLASSIC_DLEN 8
+#define SIM_CAN_DLEN 64
+typedef struct {
+  uint32_t id;
+  bool rtr;
+  uint8_t len;
+  uint8_t data[SIM_CAN_DLEN];
+} sim_can_frame;
+void sim_can_host_send(const sim_can_frame *f);
+uint8_t sim_can_valid_len(uint8_t len);
+uint16_t sim_can_timestamp(void);
+uint32_t sim_can_frames_lost(void);
+
+/* sim_i2c.c */
+void sim_i2c_set_pm(uint16_t i, uint16_t v, uint16_t v2);
+void sim_i2c_set_ads(uint16_t t1, uint16_t t2, int polls);
+void sim_i2c_nack(uint8_t addr, int count);
+
+/* sim_uart.c */
+void sim_uart_send(const char *text);
+
+/* sim_gpio.c */
+bool sim_gpio_lookup(const char *name, uint8_t *pin);
+void sim_gpio_drive(uint8_t pin, bool level);
+bool sim_gpio_level(uint8_t pin);
+
+/* sim_host.c */
+bool sim_host_load(const char *path);
+void sim_host_start(void);
+bool sim_host_done(void);
+void sim_host_frame(const sim_can_frame *f);
+void sim_host_uart_line(const char *line);
+void sim_host_report(void);
+int sim_host_failures(void);
+
+/* sim_main.c */
+extern bool sim_verbose;
+void sim_finish(void);
+
+#endif
@@ -0,0 +1,52 @@
+/** @file sim_board.c
+ * Stands in for atmel_start.c and driver_init.c: defines the driver
+ * descriptors and sets up the pins and peripherals as system_init()
+ * does on the board. usart.c supplies its own USART_Diag_init().
+ */
+#include <atmel_start.h>
+#include "usart.h"
+#include "sim.h"
+
+struct calendar_descriptor   CALENDAR;
+struct i2c_m_async_desc       I2C;
+struct usart_async_descriptor USART_Diag;
+struct can_async_descriptor   CAN_CTRL;
+
+void CALENDAR_CLOCK_init(void) {}
+void CALENDAR_init(void) {}
+void I2C_PORT_init(void) {}
+void I2C_CLOCK_init(void) {}
+void USART_Diag_PORT_init(void) {}
+void USART_Diag_CLOCK_init(void) {}
+
+void I2C_init(void) {
+  i2c_m_async_init(&I2C, SERCOM0);
+}
+
+static void CAN_CTRL_init(void) {
+  can_async_init(&CAN_CTRL, CAN1);
+}
+
+void system_init(void) {
+  gpio_set_pin_direction(ALRT, GPIO_DIRECTION_IN);
+  gpio_set_pin_direction(VDD2SENSE, GPIO_DIRECTION_IN);
+  gpio_set_pin_level(STATUS_LED, false);
+  gpio_set_pin_direction(STATUS_LED, GPIO_DIRECTION_OUT);
+  gpio_set_pin_level(FAULT_LED, false);
+  gpio_set_pin_direction(FAULT_LED, GPIO_DIRECTION_OUT);
+  gpio_set_pin_level(SHDN_N, true);
+  gpio_set_pin_direction(SHDN_N, GPIO_DIRECTION_OUT);
+  CALENDAR_init();
+  I2C_init();
+  USART_Diag_init();
+  CAN_CTRL_init();
+}
+
+/**
+ * Also opens the serial port for control.c. The firmware's main() does
+ * not use it, but the simulation polls it from sim_main.c.
+ */
+void atmel_start_init(void) {
+  system_init();
+  uart_init();
+}
@@ -0,0 +1,403 @@
+/** @file sim_can.c
+ * Mock of the HAL CAN driver, modelling the parts of the M_CAN the
+ * firmware relies on: classic standard ID filters routing into RX
+ * FIFO 0 or RX FIFO 1, receive timestamps, a TX FIFO preceded by
+ * dedicated TX buffers in message RAM, and one interrupt handler that
+ * clears its flags before running the callbacks.
+ *
+ * The bus carries one frame at a time. Among the frames waiting to go,
+ * the lowest ID wins arbitration; only the oldest frame of the TX FIFO
+ * and of the host's queue take part. Frame times are computed from the
+ * nominal and data bit timing in hpl_can_config.h, ignoring bit
+ * stuffing.
+ */
+#include <string.h>
+#include <stdio.h>
+#include <hal_can_async.h>
+#include <hpl_can_config.h>
+#include <peripheral_clk_config.h>
+#include "sim.h"
+
+#define SIM_CAN_NOM_NS ((uint64_t)CONF_CAN1_BTP_BRP * \
+  (1 + CONF_CAN1_BTP_TSEG1 + CONF_CAN1_BTP_TSEG2) * 1000000000ULL / \
+  CONF_GCLK_CAN1_FREQUENCY)
+#define SIM_CAN_DATA_NS ((uint64_t)CONF_CAN1_DBTP_DBRP * \
+  (1 + CONF_CAN1_DBTP_DTSEG1 + CONF_CAN1_DBTP_DTSEG2) * 1000000000ULL / \
+  CONF_GCLK_CAN1_FREQUENCY)
+#define SIM_CAN_TX_ELEMENTS (CONF_CAN1_TXBC_NDTB + CONF_CAN1_TXBC_TFQS)
+#define SIM_CAN_HOST_QUEUE 64
+
+#define SIM_CAN_IR_RF0N 0x01
+#define SIM_CAN_IR_RF0L 0x02
+#define SIM_CAN_IR_RF1N 0x04
+#define SIM_CAN_IR_TC   0x08
+
+typedef struct {
+  sim_can_frame f;
+  uint16_t ts;
+} sim_can_rx_element;
+
+typedef struct {
+  bool enabled;
+  bool fifo1;
+  uint32_t id;
+  uint32_t mask;
+} sim_can_std_filter;
+
+static struct can_async_descriptor *sim_can_descr;
+static bool sim_can_enabled = false;
+static uint32_t sim_can_ir = 0;
+static uint32_t sim_can_lost = 0;
+
+static sim_can_std_filter sim_can_filters[CONF_CAN1_SIDFC_LSS];
+
+static sim_can_rx_element sim_can_rxf0[CONF_CAN1_RXF0C_F0S];
+static int sim_can_rxf0_get = 0, sim_can_rxf0_n = 0;
+static sim_can_rx_element sim_can_rxf1[CONF_CAN1_RXF1C_F1S];
+static int sim_can_rxf1_get = 0, sim_can_rxf1_n = 0;
+
+/* Dedicated buffers are elements 0 to NDTB-1, the TX FIFO follows */
+static sim_can_frame sim_can_tx[SIM_CAN_TX_ELEMENTS];
+static uint32_t sim_can_txbrp = 0;
+static int sim_can_tfq_get = 0, sim_can_tfq_n = 0;
+
+static sim_can_frame sim_can_host_q[SIM_CAN_HOST_QUEUE];
+static int sim_can_host_get = 0, sim_can_host_n = 0;
+
+static bool sim_can_bus_busy = false;
+static int sim_can_bus_src; // TX element index, or -1 for the host
+static sim_can_frame sim_can_bus_frame;
+static uint16_t sim_can_bus_ts;
+
+static const uint8_t sim_can_dlc2len[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64};
+
+/** @return len rounded up to a length a DLC can express */
+uint8_t sim_can_valid_len(uint8_t len) {
+  int dlc = 0;
+  while (dlc < 15 && sim_can_dlc2len[dlc] < len) ++dlc;
+  return sim_can_dlc2len[dlc];
+}
+
+/** @return The time the frame occupies the bus, including IFS */
+static uint64_t sim_can_frame_ns(const sim_can_frame *f) {
+  if (f->len <= 8) {
+    return (47 + 8 * (uint64_t)f->len) * SIM_CAN_NOM_NS;
+  }
+  return 30 * SIM_CAN_NOM_NS + (8 * (uint64_t)f->len + 28) * SIM_CAN_DATA_NS
+    + 10 * SIM_CAN_NOM_NS;
+}
+
+/** @return The timestamp counter, TSCC_TCP nominal bit times per count */
+uint16_t sim_can_timestamp(void) {
+  return (uint16_t)(sim_now_ns() / (SIM_CAN_NOM_NS * CONF_CAN1_TSCC_TCP));
+}
+
+/** @return Frames discarded because their RX FIFO was full */
+uint32_t sim_can_frames_lost(void) {
+  return sim_can_lost;
+}
+
+/**
+ * The CAN interrupt handler. As in CAN1_Handler(), the flags are
+ * cleared before the callbacks run.
+ */
+static void sim_can_irq(void) {
+  struct can_async_descriptor *descr = sim_can_descr;
+  uint32_t ir = sim_can_ir;
+  sim_can_ir = 0;
+  if ((ir & SIM_CAN_IR_RF1N) && descr->cb.rx1_done) {
+    descr->cb.rx1_done(descr);
+  }
+  if ((ir & SIM_CAN_IR_RF0N) && descr->cb.rx_done) {
+    descr->cb.rx_done(descr);
+  }
+  if ((ir & SIM_CAN_IR_TC) && descr->cb.tx_done) {
+    descr->cb.tx_done(descr);
+  }
+  if ((ir & SIM_CAN_IR_RF0L) && descr->cb.irq_handler) {
+    descr->cb.irq_handler(descr, CAN_IRQ_DO);
+  }
+}
+
+static void sim_can_flag(uint32_t flag) {
+  sim_can_ir |= flag;
+  sim_irq_raise(sim_can_irq);
+}
+
+/**
+ * Runs a frame from the bus through the standard filters. The first
+ * enabled filter that matches decides; frames matching none, and all
+ * extended frames, are rejected as CONF_CAN1_GFC_ANFS/ANFE specify.
+ */
+static void sim_can_receive(const sim_can_frame *f, uint16_t ts) {
+  int i;
+  for (i = 0; i < CONF_CAN1_SIDFC_LSS; ++i) {
+    sim_can_std_filter *sf = &sim_can_filters[i];
+    if (sf->enabled && (f->id & sf->mask) == (sf->id & sf->mask)) {
+      sim_can_rx_element *fifo = sf->fifo1 ? sim_can_rxf1 : sim_can_rxf0;
+      int *get = sf->fifo1 ? &sim_can_rxf1_get : &sim_can_rxf0_get;
+      int *n = sf->fifo1 ? &sim_can_rxf1_n : &sim_can_rxf0_n;
+      int size = sf->fifo1 ? CONF_CAN1_RXF1C_F1S : CONF_CAN1_RXF0C_F0S;
+      if (*n == size) {
+        // Blocking mode: the new frame is lost
+        ++sim_can_lost;
+        if (!sf->fifo1) {
+          sim_can_flag(SIM_CAN_IR_RF0L);
+        }
+        return;
+      }
+      fifo[(*get + *n) % size].f = *f;
+      fifo[(*get + *n) % size].ts = ts;
+      ++*n;
+      sim_can_flag(sf->fifo1 ? SIM_CAN_IR_RF1N : SIM_CAN_IR_RF0N);
+      return;
+    }
+  }
+}
+
+static void sim_can_bus_done(void *arg);
+
+/** Starts the highest priority waiting frame, if the bus is free */
+static void sim_can_bus_kick(void) {
+  int src = -2, i;
+  uint32_t best = 0;
+  if (sim_can_bus_busy) return;
+  for (i = 0; i < CONF_CAN1_TXBC_NDTB; ++i) {
+    if ((sim_can_txbrp & (1u << i)) && (src == -2 || sim_can_tx[i].id < best)) {
+      src = i;
+      best = sim_can_tx[i].id;
+    }
+  }
+  if (sim_can_tfq_n) {
+    i = CONF_CAN1_TXBC_NDTB + sim_can_tfq_get;
+    if ((sim_can_txbrp & (1u << i)) && (src == -2 || sim_can_tx[i].id < best)) {
+      src = i;
+      best = sim_can_tx[i].id;
+    }
+  }
+  if (sim_can_host_n && (src == -2 || sim_can_host_q[sim_can_host_get].id < best)) {
+    src = -1;
+  }
+  if (src == -2) return;
+  sim_can_bus_busy = true;
+  sim_can_bus_src = src;
+  sim_can_bus_frame = src < 0 ? sim_can_host_q[sim_can_host_get] : sim_can_tx[src];
+  sim_can_bus_ts = sim_can_timestamp(); // M_CAN stamps the start of frame
+  sim_event_at(sim_now_ns() + sim_can_frame_ns(&sim_can_bus_frame),
+    sim_can_bus_done, 0);
+}
+
+/** The frame on the bus is complete */
+static void sim_can_bus_done(void *arg) {
+  // A handler run from here may start the next frame
+  sim_can_frame f = sim_can_bus_frame;
+  (void)arg;
+  sim_can_bus_busy = false;
+  if (sim_can_bus_src < 0) {
+    sim_can_host_get = (sim_can_host_get + 1) % SIM_CAN_HOST_QUEUE;
+    --sim_can_host_n;
+    if (sim_can_enabled) {
+      sim_can_receive(&f, sim_can_bus_ts);
+    }
+  } else {
+    sim_can_txbrp &= ~(1u << sim_can_bus_src);
+    if (sim_can_bus_src >= CONF_CAN1_TXBC_NDTB) {
+      sim_can_tfq_get = (sim_can_tfq_get + 1) % CONF_CAN1_TXBC_TFQS;
+      --sim_can_tfq_n;
+    }
+    sim_can_flag(SIM_CAN_IR_TC);
+    sim_host_frame(&f);
+  }
+  sim_can_bus_kick();
+}
+
+/** Queues a frame from the host for the bus */
+void sim_can_host_send(const sim_can_frame *f) {
+  if (sim_can_host_n == SIM_CAN_HOST_QUEUE) {
+    fprintf(stderr, "sim: host CAN queue overflow\n");
+    return;
+  }
+  sim_can_host_q[(sim_can_host_get + sim_can_host_n) % SIM_CAN_HOST_QUEUE] = *f;
+  ++sim_can_host_n;
+  sim_can_bus_kick();
+}
+
+int32_t can_async_init(struct can_async_descriptor *const descr, void *const hw) {
+  memset(descr, 0, sizeof(*descr));
+  descr->dev.hw = hw;
+  sim_can_descr = descr;
+  return ERR_NONE;
+}
+
+int32_t can_async_enable(struct can_async_descriptor *const descr) {
+  sim_clock_update();
+  (void)descr;
+  sim_can_enabled = true;
+  return ERR_NONE;
+}
+
+int32_t can_async_disable(struct can_async_descriptor *const descr) {
+  sim_clock_update();
+  (void)descr;
+  sim_can_enabled = false;
+  return ERR_NONE;
+}
+
+int32_t can_async_register_callback(struct can_async_descriptor *const descr, enum can_async_callback_type type,
+                                    FUNC_PTR cb) {
+  switch (type) {
+    case CAN_ASYNC_RX_CB: descr->cb.rx_done = (can_cb_t)cb; break;
+    case CAN_ASYNC_RX1_CB: descr->cb.rx1_done = (can_cb_t)cb; break;
+    case CAN_ASYNC_TX_CB: descr->cb.tx_done = (can_cb_t)cb; break;
+    case CAN_ASYNC_IRQ_CB:
+      descr->cb.irq_handler =
+        (void (*)(struct can_async_descriptor *const, enum can_async_interrupt_type))cb;
+      break;
+    default:
+      return ERR_INVALID_ARG;
+  }
+  return ERR_NONE;
+}
+
+/** Copies out the oldest element of an RX FIFO, as _can_async_read() */
+static int32_t sim_can_read(sim_can_rx_element *fifo, int *get, int *n, int size,
+                            struct can_message *msg, uint8_t dsize) {
+  sim_can_rx_element *e;
+  sim_clock_update();
+  if (*n == 0) {
+    return ERR_NOT_FOUND;
+  }
+  e = &fifo[*get];
+  msg->id = e->f.id;
+  msg->fmt = CAN_FMT_STDID;
+  if (e->f.rtr) {
+    msg->type = CAN_TYPE_REMOTE; // The HPL only ever sets REMOTE
+  }
+  msg->len = e->f.rtr ? 0 : e->f.len;
+  if (msg->len > dsize) {
+    msg->len = dsize;
+  }
+  msg->timestamp = e->ts;
+  memcpy(msg->data, e->f.data, msg->len);
+  *get = (*get + 1) % size;
+  --*n;
+  return ERR_NONE;
+}
+
+int32_t can_async_read(struct can_async_descriptor *const descr, struct can_message *msg) {
+  (void)descr;
+  return sim_can_read(sim_can_rxf0, &sim_can_rxf0_get, &sim_can_rxf0_n,
+    CONF_CAN1_RXF0C_F0S, msg, CONF_CAN1_F0DS - 8);
+}
+
+int32_t can_async_read_fifo1(struct can_async_descriptor *const descr, struct can_message *msg) {
+  (void)descr;
+  return sim_can_read(sim_can_rxf1, &sim_can_rxf1_get, &sim_can_rxf1_n,
+    CONF_CAN1_RXF1C_F1S, msg, CONF_CAN1_F1DS - 8);
+}
+
+/** @return The TX FIFO element at the put index, or NULL if full */
+static sim_can_frame *sim_can_tx_entry(void) {
+  if (sim_can_tfq_n == CONF_CAN1_TXBC_TFQS) {
+    return NULL;
+  }
+  return &sim_can_tx[CONF_CAN1_TXBC_NDTB +
+    (sim_can_tfq_get + sim_can_tfq_n) % CONF_CAN1_TXBC_TFQS];
+}
+
+static void sim_can_tx_header(sim_can_frame *f, const struct can_message *msg) {
+  f->id = msg->id;
+  f->rtr = msg->type == CAN_TYPE_REMOTE;
+  f->len = sim_can_valid_len(msg->len);
+}
+
+uint8_t *can_async_tx_buffer(struct can_async_descriptor *const descr) {
+  sim_can_frame *f;
+  (void)descr;
+  sim_clock_update();
+  f = sim_can_tx_entry();
+  return f ? f->data : NULL;
+}
+
+int32_t can_async_tx_commit(struct can_async_descriptor *const descr, struct can_message *msg) {
+  sim_can_frame *f;
+  (void)descr;
+  sim_clock_update();
+  f = sim_can_tx_entry();
+  if (f == NULL) {
+    return ERR_NO_RESOURCE;
+  }
+  sim_can_tx_header(f, msg);
+  sim_can_txbrp |= 1u << (f - sim_can_tx);
+  ++sim_can_tfq_n;
+  sim_can_bus_kick();
+  return ERR_NONE;
+}
+
+int32_t can_async_write(struct can_async_descriptor *const descr, struct can_message *msg) {
+  uint8_t *data = can_async_tx_buffer(descr);
+  if (data == NULL) {
+    return ERR_NO_RESOURCE;
+  }
+  memcpy(data, msg->data, msg->len);
+  return can_async_tx_commit(descr, msg);
+}
+
+int32_t can_async_set_tx_buffer(struct can_async_descriptor *const descr, uint8_t index, struct can_message *msg) {
+  (void)descr;
+  sim_clock_update();
+  if (index >= CONF_CAN1_TXBC_NDTB) {
+    return ERR_INVALID_ARG;
+  }
+  if (sim_can_txbrp & (1u << index)) {
+    return ERR_BUSY;
+  }
+  sim_can_tx_header(&sim_can_tx[index], msg);
+  memcpy(sim_can_tx[index].data, msg->data, msg->len);
+  return ERR_NONE;
+}
+
+void can_async_send_tx_buffers(struct can_async_descriptor *const descr, uint32_t mask) {
+  (void)descr;
+  sim_clock_update();
+  sim_can_txbrp |= mask & ((1u << CONF_CAN1_TXBC_NDTB) - 1);
+  sim_can_bus_kick();
+}
+
+uint16_t can_async_get_timestamp(struct can_async_descriptor *const descr) {
+  (void)descr;
+  sim_clock_update();
+  return sim_can_timestamp();
+}
+
+static int32_t sim_can_set_filter(uint8_t index, enum can_format fmt,
+                                  struct can_filter *filter, bool fifo1) {
+  sim_clock_update();
+  if (index >= CONF_CAN1_SIDFC_LSS) {
+    return ERR_INVALID_ARG;
+  }
+  if (fmt != CAN_FMT_STDID) {
+    return ERR_UNSUPPORTED_OP;
+  }
+  if (filter == NULL) {
+    sim_can_filters[index].enabled = false;
+    return ERR_NONE;
+  }
+  sim_can_filters[index].id = filter->id & 0x7FF;
+  sim_can_filters[index].mask = filter->mask & 0x7FF;
+  sim_can_filters[index].fifo1 = fifo1;
+  sim_can_filters[index].enabled = true;
+  return ERR_NONE;
+}
+
+int32_t can_async_set_filter(struct can_async_descriptor *const descr, uint8_t index, enum can_format fmt,
+                             struct can_filter *filter) {
+  (void)descr;
+  return sim_can_set_filter(index, fmt, filter, false);
+}
+
+int32_t can_async_set_priority_filter(struct can_async_descriptor *const descr, uint8_t index, enum can_format fmt,
+                                      struct can_filter *filter) {
+  (void)descr;
+  return sim_can_set_filter(index, fmt, filter, true);
+}
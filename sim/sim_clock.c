@@ -0,0 +1,261 @@
+/** @file sim_clock.c
+ * Virtual time for the host simulation. While the firmware is busy,
+ * virtual time follows the host clock. When it sleeps in __WFI(), time
+ * jumps ahead to the next scheduled event, so idle periods cost no host
+ * time. Simulated peripherals schedule their completions as events, and
+ * SysTick is derived from the same clock.
+ *
+ * Events and SysTick interrupts are delivered from sim_clock_update(),
+ * which the mock HAL calls on entry to every function, before it looks
+ * at its own state. A handler can therefore run at any HAL call made
+ * with interrupts enabled, much as it could at any instruction on the
+ * board.
+ */
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <compiler.h>
+#include <peripheral_clk_config.h>
+#include "sim.h"
+
+#define SIM_EVENTS_MAX 32
+
+typedef struct {
+  bool active;
+  uint64_t t;
+  sim_event_fn fn;
+  void *arg;
+} sim_event;
+
+static sim_event sim_events[SIM_EVENTS_MAX];
+static struct timespec sim_host_base;
+static bool sim_host_base_set = false;
+static uint64_t sim_skipped_ns = 0;
+static uint64_t sim_busy_end = 0;
+
+static SysTick_Type sim_systick_regs;
+static bool sim_systick_on = false;
+static uint64_t sim_systick_ns;
+static uint64_t sim_systick_next;
+
+static uint64_t sim_loop_start = 0;
+static uint64_t sim_loop_count = 0;
+static uint64_t sim_loop_worst = 0;
+static uint64_t sim_loop_total = 0;
+
+/** @return Host nanoseconds since the first call */
+uint64_t sim_host_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  if (!sim_host_base_set) {
+    sim_host_base = ts;
+    sim_host_base_set = true;
+  }
+  return (uint64_t)(ts.tv_sec - sim_host_base.tv_sec) * 1000000000ULL
+    + ts.tv_nsec - sim_host_base.tv_nsec;
+}
+
+/** @return Virtual nanoseconds since the simulation started */
+uint64_t sim_now_ns(void) {
+  return sim_host_ns() + sim_skipped_ns;
+}
+
+/**
+ * Schedules fn(arg) at virtual time t. Events at the same time run in
+ * the order they were scheduled.
+ */
+void sim_event_at(uint64_t t, sim_event_fn fn, void *arg) {
+  int i;
+  for (i = 0; i < SIM_EVENTS_MAX; ++i) {
+    if (!sim_events[i].active) {
+      sim_events[i].active = true;
+      sim_events[i].t = t;
+      sim_events[i].fn = fn;
+      sim_events[i].arg = arg;
+      return;
+    }
+  }
+  fprintf(stderr, "sim: event queue overflow\n");
+  exit(2);
+}
+
+/** Removes any scheduled call of fn(arg) */
+void sim_event_cancel(sim_event_fn fn, void *arg) {
+  int i;
+  for (i = 0; i < SIM_EVENTS_MAX; ++i) {
+    if (sim_events[i].active && sim_events[i].fn == fn &&
+        sim_events[i].arg == arg) {
+      sim_events[i].active = false;
+    }
+  }
+}
+
+/** @return The index of the earliest event, or -1 if none */
+static int sim_event_next(void) {
+  int i, next = -1;
+  for (i = 0; i < SIM_EVENTS_MAX; ++i) {
+    if (sim_events[i].active &&
+        (next < 0 || sim_events[i].t < sim_events[next].t)) {
+      next = i;
+    }
+  }
+  return next;
+}
+
+/** @return The virtual time of the next event or SysTick, or UINT64_MAX */
+static uint64_t sim_next_due(void) {
+  int next = sim_event_next();
+  uint64_t t = next < 0 ? UINT64_MAX : sim_events[next].t;
+  if (sim_systick_on && sim_systick_next < t) {
+    t = sim_systick_next;
+  }
+  return t;
+}
+
+/**
+ * Delivers every event and SysTick interrupt that is due, in time
+ * order. Calls made from the handlers it runs return at once.
+ */
+void sim_clock_update(void) {
+  static bool updating = false;
+  uint64_t now;
+  if (updating) return;
+  updating = true;
+  now = sim_now_ns();
+  for (;;) {
+    int next = sim_event_next();
+    uint64_t t_event = next < 0 ? UINT64_MAX : sim_events[next].t;
+    if (sim_systick_on && sim_systick_next <= now &&
+        sim_systick_next <= t_event) {
+      sim_systick_next += sim_systick_ns;
+      sim_irq_raise(SysTick_Handler);
+    } else if (t_event <= now) {
+      sim_events[next].active = false;
+      sim_events[next].fn(sim_events[next].arg);
+    } else {
+      break;
+    }
+  }
+  updating = false;
+}
+
+/**
+ * @return SysTick's registers, with VAL brought up to date. tick.c
+ *   reads VAL directly, between HAL calls.
+ */
+SysTick_Type *sim_systick(void) {
+  if (sim_systick_on) {
+    uint64_t now = sim_now_ns();
+    uint64_t left = sim_systick_next > now ? sim_systick_next - now : 0;
+    uint64_t val = left * CONF_CPU_FREQUENCY / 1000000000ULL;
+    sim_systick_regs.VAL = val > sim_systick_regs.LOAD ?
+      sim_systick_regs.LOAD : (uint32_t)val;
+  }
+  return &sim_systick_regs;
+}
+
+/** Starts the SysTick interrupt every ticks CPU cycles */
+uint32_t SysTick_Config(uint32_t ticks) {
+  sim_systick_regs.LOAD = ticks - 1;
+  sim_systick_regs.VAL = ticks - 1;
+  sim_systick_regs.CTRL = 7;
+  sim_systick_ns = (uint64_t)ticks * 1000000000ULL / CONF_CPU_FREQUENCY;
+  sim_systick_next = sim_now_ns() + sim_systick_ns;
+  sim_systick_on = true;
+  return 0;
+}
+
+static void sim_loop_record(uint64_t now) {
+  uint64_t dt = now - sim_loop_start;
+  sim_loop_total += dt;
+  if (dt > sim_loop_worst) {
+    sim_loop_worst = dt;
+  }
+}
+
+/** Marks the start of a main loop iteration */
+void sim_loop_begin(void) {
+  uint64_t now = sim_host_ns();
+  if (sim_loop_start) {
+    sim_loop_record(now);
+  }
+  sim_loop_start = now;
+  ++sim_loop_count;
+}
+
+/** Marks the end of a main loop iteration that goes to sleep */
+void sim_loop_idle(void) {
+  if (sim_loop_start) {
+    sim_loop_record(sim_host_ns());
+    sim_loop_start = 0;
+  }
+}
+
+uint64_t sim_loop_iterations(void) {
+  return sim_loop_count;
+}
+
+/** @return The longest main loop iteration in host nanoseconds */
+uint64_t sim_loop_worst_ns(void) {
+  return sim_loop_worst;
+}
+
+/** @return Host nanoseconds spent in main loop iterations */
+uint64_t sim_loop_busy_ns(void) {
+  return sim_loop_total;
+}
+
+/** Makes the main loop busy until virtual time t. See sim_busy_run(). */
+void sim_busy_until(uint64_t t) {
+  sim_busy_end = t;
+}
+
+/**
+ * Called from the main loop. Spends virtual time up to the end set by
+ * sim_busy_until() as a slow driver would, delivering events and
+ * interrupts on the way.
+ */
+void sim_busy_run(void) {
+  for (;;) {
+    uint64_t now, t;
+    sim_clock_update();
+    now = sim_now_ns();
+    if (now >= sim_busy_end) {
+      break;
+    }
+    t = sim_next_due();
+    if (t > sim_busy_end) {
+      t = sim_busy_end;
+    }
+    if (t > now) {
+      sim_skipped_ns += t - now;
+    }
+  }
+}
+
+/**
+ * The firmware's __WFI(). It is called with interrupts masked, and
+ * returns once an interrupt is pending, skipping virtual time forward
+ * to the next event as often as needed. The simulation ends here once
+ * the script is finished.
+ */
+void sim_wfi(void) {
+  sim_loop_idle();
+  sim_clock_update();
+  while (!sim_irq_pending()) {
+    uint64_t now, t;
+    if (sim_host_done()) {
+      sim_finish();
+    }
+    now = sim_now_ns();
+    t = sim_next_due();
+    if (t == UINT64_MAX) {
+      fprintf(stderr, "sim: firmware is asleep with nothing to wake it\n");
+      exit(2);
+    }
+    if (t > now) {
+      sim_skipped_ns += t - now;
+    }
+    sim_clock_update();
+  }
+}
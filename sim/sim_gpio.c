@@ -0,0 +1,97 @@
+/** @file sim_gpio.c
+ * Pin levels for the host simulation, behind the mock GPIO HPL in
+ * include/hpl_gpio_base.h. Input pins read the level the script drives,
+ * output pins read back what the firmware wrote. Changes of the named
+ * output pins are logged when running verbose.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <hal_gpio.h>
+#include "atmel_start_pins.h"
+#include "sim.h"
+
+#define SIM_GPIO_PORTS 2
+
+static uint32_t sim_gpio_out[SIM_GPIO_PORTS];
+static uint32_t sim_gpio_in[SIM_GPIO_PORTS];
+static uint32_t sim_gpio_dir[SIM_GPIO_PORTS]; // 1 for outputs
+
+static const struct {
+  const char *name;
+  uint8_t pin;
+} sim_gpio_names[] = {
+  { "ALRT", ALRT },
+  { "VDD2SENSE", VDD2SENSE },
+  { "STATUS_LED", STATUS_LED },
+  { "FAULT_LED", FAULT_LED },
+  { "SHDN_N", SHDN_N },
+};
+#define SIM_GPIO_N_NAMES (sizeof(sim_gpio_names)/sizeof(sim_gpio_names[0]))
+
+/** @return true and sets pin if name is one of the board's pins */
+bool sim_gpio_lookup(const char *name, uint8_t *pin) {
+  unsigned i;
+  for (i = 0; i < SIM_GPIO_N_NAMES; ++i) {
+    if (strcmp(name, sim_gpio_names[i].name) == 0) {
+      *pin = sim_gpio_names[i].pin;
+      return true;
+    }
+  }
+  return false;
+}
+
+static void sim_gpio_log(enum gpio_port port, uint32_t changed) {
+  unsigned i;
+  if (!sim_verbose) return;
+  for (i = 0; i < SIM_GPIO_N_NAMES; ++i) {
+    uint8_t pin = sim_gpio_names[i].pin;
+    if (GPIO_PORT(pin) == port && (changed & (1u << GPIO_PIN(pin)))) {
+      printf("%10.3f ms: %s = %d\n", sim_now_ns() / 1e6,
+        sim_gpio_names[i].name, sim_gpio_level(pin));
+    }
+  }
+}
+
+void sim_gpio_set_direction(enum gpio_port port, uint32_t mask, enum gpio_direction direction) {
+  sim_clock_update();
+  if (port >= SIM_GPIO_PORTS) return;
+  if (direction == GPIO_DIRECTION_OUT) {
+    sim_gpio_dir[port] |= mask;
+  } else {
+    sim_gpio_dir[port] &= ~mask;
+  }
+}
+
+void sim_gpio_set_level(enum gpio_port port, uint32_t mask, bool level) {
+  uint32_t was;
+  sim_clock_update();
+  if (port >= SIM_GPIO_PORTS) return;
+  was = sim_gpio_out[port];
+  if (level) {
+    sim_gpio_out[port] |= mask;
+  } else {
+    sim_gpio_out[port] &= ~mask;
+  }
+  sim_gpio_log(port, (was ^ sim_gpio_out[port]) & sim_gpio_dir[port]);
+}
+
+uint32_t sim_gpio_get_level(enum gpio_port port) {
+  sim_clock_update();
+  if (port >= SIM_GPIO_PORTS) return 0;
+  return (sim_gpio_out[port] & sim_gpio_dir[port]) |
+    (sim_gpio_in[port] & ~sim_gpio_dir[port]);
+}
+
+/** Sets the level the outside world drives onto an input pin */
+void sim_gpio_drive(uint8_t pin, bool level) {
+  if (level) {
+    sim_gpio_in[GPIO_PORT(pin)] |= 1u << GPIO_PIN(pin);
+  } else {
+    sim_gpio_in[GPIO_PORT(pin)] &= ~(1u << GPIO_PIN(pin));
+  }
+}
+
+/** @return The level on a pin, whichever way it is driven */
+bool sim_gpio_level(uint8_t pin) {
+  return (sim_gpio_get_level(GPIO_PORT(pin)) >> GPIO_PIN(pin)) & 1;
+}
@@ -0,0 +1,635 @@
+/** @file sim_host.c
+ * Runs the simulation script: the CAN host, the serial terminal and the
+ * analog world around the board. The host is closed-loop: it sends a
+ * request, waits for the whole reply, checks it and goes on with the
+ * next line. See README.md for the script format.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "can_control.h"
+#include "sim.h"
+
+#define SIM_HOST_MAX_DATA 256
+#define SIM_HOST_LINE_MAX 512
+#define SIM_HOST_TIMEOUT_MS 100
+
+enum sim_op { op_req, op_frame, op_rtr, op_emerg, op_expect_frame,
+              op_uart, op_expect_uart, op_wait, op_busy, op_timeout, op_pin, op_expect_pin,
+              op_pm, op_ads, op_nack };
+
+typedef struct {
+  int n;
+  bool any_tail; // "..." ends the pattern
+  uint8_t byte[SIM_HOST_MAX_DATA];
+  bool wild[SIM_HOST_MAX_DATA];
+} sim_pattern;
+
+typedef struct {
+  int line;
+  enum sim_op op;
+  uint32_t id;
+  uint8_t cmd;
+  bool bcast;
+  bool noreply;
+  bool fd;
+  bool has_expect;
+  bool expect_error;
+  int n_data;
+  uint8_t data[SIM_HOST_MAX_DATA];
+  sim_pattern expect;
+  unsigned repeat;
+  char *text;
+  char *expect_text;
+  uint32_t value[3];
+} sim_cmd;
+
+static const char *sim_host_path;
+static sim_cmd *sim_cmds;
+static int sim_n_cmds = 0;
+static int sim_pc = 0;
+static unsigned sim_repeat_left = 0;
+
+enum sim_host_state { host_idle, host_reply, host_frame, host_uart, host_wait, host_done };
+static enum sim_host_state sim_state = host_idle;
+static const sim_cmd *sim_cur;
+static uint32_t sim_timeout_ms = SIM_HOST_TIMEOUT_MS;
+
+/* The reply being collected */
+static uint32_t sim_reply_id;
+static int sim_reply_seq;
+static uint8_t sim_reply_cmd;
+static int sim_reply_len;
+static int sim_reply_nc;
+static uint8_t sim_reply[SIM_HOST_MAX_DATA];
+
+static int sim_failures = 0;
+static uint32_t sim_requests = 0;
+static uint32_t sim_other_frames = 0;
+static uint64_t sim_req_sent_ns;
+static uint64_t sim_first_req_ns = 0;
+static uint64_t sim_last_reply_ns = 0;
+static uint64_t sim_latency_total = 0;
+static uint64_t sim_latency_worst = 0;
+
+static void sim_host_step(void *arg);
+
+static void sim_host_fail(const sim_cmd *c, const char *fmt, const char *detail) {
+  fprintf(stderr, "%s:%d: ", sim_host_path, c->line);
+  fprintf(stderr, fmt, detail);
+  fputc('\n', stderr);
+  ++sim_failures;
+}
+
+static void sim_host_syntax(int line, const char *msg, const char *tok) {
+  fprintf(stderr, "%s:%d: %s%s%s\n", sim_host_path, line, msg,
+    tok ? ": " : "", tok ? tok : "");
+  exit(2);
+}
+
+static uint32_t sim_parse_num(int line, const char *tok, int base, uint32_t max) {
+  char *end;
+  unsigned long v;
+  if (tok == NULL) {
+    sim_host_syntax(line, "missing argument", NULL);
+  }
+  v = strtoul(tok, &end, base);
+  if (*end != '\0' || v > max) {
+    sim_host_syntax(line, "bad number", tok);
+  }
+  return (uint32_t)v;
+}
+
+static uint8_t sim_parse_cmd(int line, const char *tok) {
+  static const struct { const char *name; uint8_t code; } names[] = {
+    { "rd", CAN_CMD_CODE_RD },
+    { "rd_inc", CAN_CMD_CODE_RD_INC },
+    { "rd_noinc", CAN_CMD_CODE_RD_NOINC },
+    { "rd_cnt_noinc", CAN_CMD_CODE_RD_CNT_NOINC },
+    { "wr_inc", CAN_CMD_CODE_WR_INC },
+    { "wr_noinc", CAN_CMD_CODE_WR_NOINC },
+    { "ext", CAN_CMD_CODE_EXT },
+  };
+  unsigned i;
+  for (i = 0; tok && i < sizeof(names)/sizeof(names[0]); ++i) {
+    if (strcmp(tok, names[i].name) == 0) {
+      return names[i].code;
+    }
+  }
+  return (uint8_t)sim_parse_num(line, tok, 16, CAN_CMD_CODE_MASK);
+}
+
+/** Parses hex bytes up to "->", "*n" or the end of the line */
+static char *sim_parse_bytes(int line, char *tok, uint8_t *data, int *n) {
+  *n = 0;
+  for (; tok && strcmp(tok, "->") && tok[0] != '*'; tok = strtok(NULL, " \t")) {
+    if (*n == 0xFF) { // The length must fit in one byte
+      sim_host_syntax(line, "too many bytes", tok);
+    }
+    data[(*n)++] = (uint8_t)sim_parse_num(line, tok, 16, 0xFF);
+  }
+  return tok;
+}
+
+/** Parses an expected payload: hex bytes, "xx" for any byte, "..." */
+static char *sim_parse_pattern(int line, char *tok, sim_pattern *p) {
+  p->n = 0;
+  p->any_tail = false;
+  for (; tok && tok[0] != '*'; tok = strtok(NULL, " \t")) {
+    if (p->any_tail || p->n == SIM_HOST_MAX_DATA) {
+      sim_host_syntax(line, "unexpected", tok);
+    }
+    if (strcmp(tok, "...") == 0) {
+      p->any_tail = true;
+    } else if (strcmp(tok, "xx") == 0) {
+      p->wild[p->n++] = true;
+    } else {
+      p->wild[p->n] = false;
+      p->byte[p->n++] = (uint8_t)sim_parse_num(line, tok, 16, 0xFF);
+    }
+  }
+  return tok;
+}
+
+static bool sim_pattern_match(const sim_pattern *p, const uint8_t *data, int n) {
+  int i;
+  if (p->any_tail ? n < p->n : n != p->n) {
+    return false;
+  }
+  for (i = 0; i < p->n; ++i) {
+    if (!p->wild[i] && p->byte[i] != data[i]) return false;
+  }
+  return true;
+}
+
+static char *sim_strdup(const char *s) {
+  char *d = malloc(strlen(s)+1);
+  strcpy(d, s);
+  return d;
+}
+
+/** Parses the text of a uart line, splitting off the expected reply */
+static void sim_parse_uart(sim_cmd *c, char *rest) {
+  char *arrow = strstr(rest, "->");
+  if (arrow) {
+    char *exp = arrow + 2;
+    while (isspace((unsigned char)*exp)) ++exp;
+    c->expect_text = sim_strdup(exp);
+    *arrow = '\0';
+  }
+  while (*rest && isspace((unsigned char)*rest)) ++rest;
+  {
+    int n = strlen(rest);
+    while (n > 0 && isspace((unsigned char)rest[n-1])) rest[--n] = '\0';
+  }
+  c->text = sim_strdup(rest);
+}
+
+static void sim_parse_line(sim_cmd *c, char *buf) {
+  char *rest = buf + strcspn(buf, " \t");
+  char *tok;
+  rest = *rest ? rest+1 : rest; // Before strtok() replaces the separator
+  tok = strtok(buf, " \t");
+  c->repeat = 1;
+  if (strcmp(tok, "req") == 0) {
+    c->op = op_req;
+    tok = strtok(NULL, " \t");
+    for (;;) {
+      if (tok && strcmp(tok, "bcast") == 0) {
+        c->bcast = true;
+      } else if (tok && strcmp(tok, "noreply") == 0) {
+        c->noreply = true;
+      } else if (tok && strcmp(tok, "fd") == 0) {
+        c->fd = true;
+      } else {
+        break;
+      }
+      tok = strtok(NULL, " \t");
+    }
+    c->id = sim_parse_num(c->line, tok, 16, CAN_ID_REQID_MASK);
+    c->cmd = sim_parse_cmd(c->line, strtok(NULL, " \t"));
+    tok = sim_parse_bytes(c->line, strtok(NULL, " \t"), c->data, &c->n_data);
+    if (tok && strcmp(tok, "->") == 0) {
+      c->has_expect = true;
+      tok = strtok(NULL, " \t");
+      if (tok && strcmp(tok, "error") == 0) {
+        c->expect_error = true;
+        tok = strtok(NULL, " \t");
+      }
+      tok = sim_parse_pattern(c->line, tok, &c->expect);
+    }
+    if (tok) {
+      c->repeat = sim_parse_num(c->line, tok+1, 10, 100000000);
+      if (strtok(NULL, " \t")) {
+        sim_host_syntax(c->line, "text after repeat count", NULL);
+      }
+    }
+    if ((c->bcast || c->noreply) && c->has_expect) {
+      sim_host_syntax(c->line, "broadcast and noreply requests are not answered", NULL);
+    }
+  } else if (strcmp(tok, "frame") == 0 || strcmp(tok, "rtr") == 0) {
+    c->op = tok[0] == 'f' ? op_frame : op_rtr;
+    c->id = sim_parse_num(c->line, strtok(NULL, " \t"), 16, 0x7FF);
+    if (c->op == op_frame) {
+      sim_parse_bytes(c->line, strtok(NULL, " \t"), c->data, &c->n_data);
+      if (c->n_data > SIM_CAN_DLEN) {
+        sim_host_syntax(c->line, "frames carry at most 64 bytes", NULL);
+      }
+    }
+  } else if (strcmp(tok, "emerg") == 0) {
+    c->op = op_emerg;
+    c->id = sim_parse_num(c->line, strtok(NULL, " \t"), 16, CAN_ID_REQID_MASK);
+    c->cmd = sim_parse_num(c->line, strtok(NULL, " \t"), 16, 0xFF);
+  } else if (strcmp(tok, "expect") == 0) {
+    tok = strtok(NULL, " \t");
+    if (tok && strcmp(tok, "frame") == 0) {
+      c->op = op_expect_frame;
+      c->id = sim_parse_num(c->line, strtok(NULL, " \t"), 16, 0x7FF);
+      c->has_expect = true;
+      sim_parse_pattern(c->line, strtok(NULL, " \t"), &c->expect);
+      if (!c->expect.n && !c->expect.any_tail) {
+        c->expect.any_tail = true;
+      }
+    } else if (tok && strcmp(tok, "uart") == 0) {
+      c->op = op_expect_uart;
+      tok = strtok(NULL, "");
+      if (!tok) {
+        sim_host_syntax(c->line, "expect uart what?", NULL);
+      }
+      sim_parse_uart(c, tok);
+      c->expect_text = c->text;
+    } else if (tok && strcmp(tok, "pin") == 0) {
+      uint8_t pin;
+      c->op = op_expect_pin;
+      tok = strtok(NULL, " \t");
+      if (!tok || !sim_gpio_lookup(tok, &pin)) {
+        sim_host_syntax(c->line, "unknown pin", tok);
+      }
+      c->value[0] = pin;
+      c->value[1] = sim_parse_num(c->line, strtok(NULL, " \t"), 10, 1);
+    } else {
+      sim_host_syntax(c->line, "expect what?", tok);
+    }
+  } else if (strcmp(tok, "uart") == 0) {
+    c->op = op_uart;
+    sim_parse_uart(c, rest);
+  } else if (strcmp(tok, "wait") == 0 || strcmp(tok, "busy") == 0 ||
+             strcmp(tok, "timeout") == 0) {
+    c->op = tok[0] == 'w' ? op_wait : tok[0] == 'b' ? op_busy : op_timeout;
+    c->value[0] = sim_parse_num(c->line, strtok(NULL, " \t"), 10, 3600000);
+  } else if (strcmp(tok, "pin") == 0) {
+    uint8_t pin;
+    c->op = op_pin;
+    tok = strtok(NULL, " \t");
+    if (!tok || !sim_gpio_lookup(tok, &pin)) {
+      sim_host_syntax(c->line, "unknown pin", tok);
+    }
+    c->value[0] = pin;
+    c->value[1] = sim_parse_num(c->line, strtok(NULL, " \t"), 10, 1);
+  } else if (strcmp(tok, "pm") == 0) {
+    int i;
+    c->op = op_pm;
+    for (i = 0; i < 3; ++i) {
+      c->value[i] = sim_parse_num(c->line, strtok(NULL, " \t"), 16, 0xFFFF);
+    }
+  } else if (strcmp(tok, "ads") == 0) {
+    c->op = op_ads;
+    c->value[0] = sim_parse_num(c->line, strtok(NULL, " \t"), 16, 0xFFFF);
+    c->value[1] = sim_parse_num(c->line, strtok(NULL, " \t"), 16, 0xFFFF);
+    tok = strtok(NULL, " \t");
+    c->value[2] = tok ? sim_parse_num(c->line, tok, 10, 1000) : 2;
+  } else if (strcmp(tok, "nack") == 0) {
+    c->op = op_nack;
+    c->value[0] = sim_parse_num(c->line, strtok(NULL, " \t"), 16, 0x7F);
+    c->value[1] = sim_parse_num(c->line, strtok(NULL, " \t"), 10, 1000000);
+  } else {
+    sim_host_syntax(c->line, "unknown command", tok);
+  }
+}
+
+/**
+ * Reads and checks the whole script before the firmware starts
+ * @return false if the file cannot be read
+ */
+bool sim_host_load(const char *path) {
+  char buf[SIM_HOST_LINE_MAX];
+  int line = 0, max = 0;
+  FILE *fp = fopen(path, "r");
+  if (fp == NULL) {
+    return false;
+  }
+  sim_host_path = path;
+  while (fgets(buf, sizeof(buf), fp)) {
+    char *p = buf;
+    ++line;
+    buf[strcspn(buf, "#\r\n")] = '\0';
+    while (isspace((unsigned char)*p)) ++p;
+    if (*p == '\0') continue;
+    if (sim_n_cmds == max) {
+      max = max ? 2*max : 64;
+      sim_cmds = realloc(sim_cmds, max * sizeof(sim_cmd));
+    }
+    memset(&sim_cmds[sim_n_cmds], 0, sizeof(sim_cmd));
+    sim_cmds[sim_n_cmds].line = line;
+    sim_parse_line(&sim_cmds[sim_n_cmds], p);
+    ++sim_n_cmds;
+  }
+  fclose(fp);
+  return true;
+}
+
+static void sim_host_print_frame(const char *dir, const sim_can_frame *f) {
+  int i;
+  printf("%10.3f ms: %s %03X%s", sim_now_ns() / 1e6, dir, (unsigned)f->id,
+    f->rtr ? " rtr" : "");
+  for (i = 0; i < f->len; ++i) {
+    printf(" %02X", f->data[i]);
+  }
+  putchar('\n');
+}
+
+/** Sends a frame, padding FD payloads with zeros to a valid length */
+static void sim_host_send(uint32_t id, const uint8_t *data, int len, bool rtr) {
+  sim_can_frame f;
+  f.id = id;
+  f.rtr = rtr;
+  f.len = sim_can_valid_len(len);
+  memcpy(f.data, data, len);
+  memset(&f.data[len], 0, f.len - len);
+  if (sim_verbose) {
+    sim_host_print_frame("host ->", &f);
+  }
+  sim_can_host_send(&f);
+}
+
+/** Sends a request as classic or FD frames: [cmd, len, data...] first,
+ *  then [cmd|seq, data...] */
+static void sim_host_send_request(const sim_cmd *c) {
+  uint32_t id = CAN_ID_BOARD(c->bcast ? CAN_BROADCAST_ID : CAN_BOARD_ID) | c->id;
+  uint8_t frame[SIM_CAN_DLEN];
+  int dlen = c->fd ? SIM_CAN_DLEN : SIM_CAN_CLASSIC_DLEN;
+  int cp = 0, seq = 0;
+  do {
+    int n = 0, nb;
+    if (seq == 0) {
+      frame[n++] = c->cmd;
+      frame[n++] = c->n_data;
+    } else {
+      frame[n++] = c->cmd | CAN_SEQ_CMD(seq);
+    }
+    nb = dlen - n;
+    if (nb > c->n_data - cp) nb = c->n_data - cp;
+    memcpy(&frame[n], &c->data[cp], nb);
+    cp += nb;
+    sim_host_send(id, frame, n + nb, false);
+    ++seq;
+  } while (cp < c->n_data);
+}
+
+static void sim_host_timeout(void *arg) {
+  (void)arg;
+  sim_host_fail(sim_cur, "%s", sim_state == host_uart ?
+    "no serial response" : "no reply");
+  sim_state = host_idle;
+  sim_repeat_left = 0;
+  sim_host_step(0);
+}
+
+static void sim_host_await(enum sim_host_state state) {
+  sim_state = state;
+  sim_event_at(sim_now_ns() + sim_timeout_ms * SIM_NS_PER_MS, sim_host_timeout, 0);
+}
+
+/** Goes on with the script once the current command is complete */
+static void sim_host_continue(void) {
+  sim_event_cancel(sim_host_timeout, 0);
+  sim_state = host_idle;
+  sim_event_at(sim_now_ns(), sim_host_step, 0);
+}
+
+static void sim_host_wait_done(void *arg) {
+  (void)arg;
+  sim_host_continue();
+}
+
+static void sim_host_reply_done(void) {
+  const sim_cmd *c = sim_cur;
+  uint64_t now = sim_now_ns();
+  uint64_t latency = now - sim_req_sent_ns;
+  ++sim_requests;
+  sim_last_reply_ns = now;
+  sim_latency_total += latency;
+  if (latency > sim_latency_worst) {
+    sim_latency_worst = latency;
+  }
+  if (c->has_expect) {
+    bool is_error = sim_reply_cmd == CAN_CMD_CODE_ERROR;
+    if (is_error != c->expect_error ||
+        (!is_error && sim_reply_cmd != c->cmd) ||
+        !sim_pattern_match(&c->expect, sim_reply, sim_reply_nc)) {
+      char got[3*SIM_HOST_MAX_DATA+16];
+      int i, n;
+      n = sprintf(got, "%s", is_error ? "error" : "");
+      for (i = 0; i < sim_reply_nc; ++i) {
+        n += sprintf(got+n, "%s%02X", n ? " " : "", sim_reply[i]);
+      }
+      sim_host_fail(c, "reply mismatch, got: %s", got);
+      sim_repeat_left = 0;
+    }
+  } else if (sim_reply_cmd == CAN_CMD_CODE_ERROR) {
+    sim_host_fail(c, "%s", "unexpected error reply");
+    sim_repeat_left = 0;
+  }
+  sim_host_continue();
+}
+
+/** Collects the reply to the current request, frame by frame */
+static bool sim_host_reply_frame(const sim_can_frame *f) {
+  int off, nb;
+  if (sim_state != host_reply || f->id != sim_reply_id || f->rtr || f->len < 1) {
+    return false;
+  }
+  if (sim_reply_seq == 0) {
+    if (f->len < 2 || CAN_CMD_SEQ(f->data[0]) != 0) {
+      sim_host_fail(sim_cur, "%s", "malformed first reply frame");
+      return true;
+    }
+    sim_reply_cmd = CAN_CMD_CODE(f->data[0]);
+    sim_reply_len = f->data[1];
+    off = 2;
+  } else {
+    if (CAN_CMD_CODE(f->data[0]) != sim_reply_cmd ||
+        CAN_CMD_SEQ(f->data[0]) != (sim_reply_seq & (CAN_CMD_SEQ_MASK >> 3))) {
+      sim_host_fail(sim_cur, "%s", "reply frame out of sequence");
+      return true;
+    }
+    off = 1;
+  }
+  ++sim_reply_seq;
+  nb = f->len - off;
+  if (nb > sim_reply_len - sim_reply_nc) {
+    nb = sim_reply_len - sim_reply_nc; // FD padding
+  }
+  memcpy(&sim_reply[sim_reply_nc], &f->data[off], nb);
+  sim_reply_nc += nb;
+  if (sim_reply_nc == sim_reply_len) {
+    sim_host_reply_done();
+  }
+  return true;
+}
+
+/** A frame sent by the firmware has completed on the bus */
+void sim_host_frame(const sim_can_frame *f) {
+  if (sim_verbose) {
+    sim_host_print_frame("host <-", f);
+  }
+  if (sim_host_reply_frame(f)) {
+    return;
+  }
+  if (sim_state == host_frame && f->id == sim_cur->id && !f->rtr) {
+    if (!sim_pattern_match(&sim_cur->expect, f->data, f->len)) {
+      sim_host_fail(sim_cur, "%s", "frame mismatch");
+    }
+    sim_host_continue();
+    return;
+  }
+  ++sim_other_frames;
+}
+
+/** A complete line of serial output */
+void sim_host_uart_line(const char *line) {
+  const char *exp, *p;
+  if (sim_verbose) {
+    printf("%10.3f ms: uart <- %s\n", sim_now_ns() / 1e6, line);
+  }
+  if (sim_state != host_uart) {
+    return;
+  }
+  exp = sim_cur->expect_text;
+  if (exp) {
+    for (p = line; *exp && *p && (*exp == '?' || *exp == *p); ++exp, ++p);
+    if (*exp || *p) {
+      sim_host_fail(sim_cur, "serial response mismatch, got: %s", line);
+    }
+  }
+  sim_host_continue();
+}
+
+static void sim_host_send_uart(const sim_cmd *c) {
+  char buf[SIM_HOST_LINE_MAX+2];
+  if (sim_verbose) {
+    printf("%10.3f ms: uart -> %s\n", sim_now_ns() / 1e6, c->text);
+  }
+  snprintf(buf, sizeof(buf), "%s\n", c->text);
+  sim_uart_send(buf);
+}
+
+/**
+ * Executes script commands until one has to wait for the firmware or
+ * for time to pass
+ */
+static void sim_host_step(void *arg) {
+  (void)arg;
+  while (sim_state == host_idle) {
+    const sim_cmd *c;
+    if (sim_repeat_left == 0) {
+      if (sim_pc == sim_n_cmds) {
+        sim_state = host_done;
+        return;
+      }
+      sim_cur = &sim_cmds[sim_pc++];
+      sim_repeat_left = sim_cur->repeat;
+    }
+    c = sim_cur;
+    --sim_repeat_left;
+    switch (c->op) {
+      case op_req:
+        sim_host_send_request(c);
+        if (!c->bcast && !c->noreply) {
+          sim_req_sent_ns = sim_now_ns();
+          if (sim_first_req_ns == 0) {
+            sim_first_req_ns = sim_req_sent_ns;
+          }
+          sim_reply_id = CAN_ID_BOARD(CAN_BOARD_ID) | CAN_ID_REPLY_BIT | c->id;
+          sim_reply_seq = 0;
+          sim_reply_len = 1; // Until the first frame says otherwise
+          sim_reply_nc = 0;
+          sim_host_await(host_reply);
+        }
+        break;
+      case op_frame:
+        sim_host_send(c->id, c->data, c->n_data, false);
+        break;
+      case op_rtr:
+        sim_host_send(c->id, c->data, 0, true);
+        break;
+      case op_emerg:
+        sim_host_send(CAN_EMERG_ID(c->id), &c->cmd, 1, false);
+        break;
+      case op_expect_frame:
+        sim_host_await(host_frame);
+        break;
+      case op_uart:
+        sim_host_send_uart(c);
+        sim_host_await(host_uart);
+        break;
+      case op_expect_uart:
+        sim_host_await(host_uart);
+        break;
+      case op_wait:
+        sim_state = host_wait;
+        sim_event_at(sim_now_ns() + c->value[0] * SIM_NS_PER_MS,
+          sim_host_wait_done, 0);
+        break;
+      case op_busy:
+        sim_busy_until(sim_now_ns() + c->value[0] * SIM_NS_PER_MS);
+        break;
+      case op_timeout:
+        sim_timeout_ms = c->value[0];
+        break;
+      case op_pin:
+        sim_gpio_drive(c->value[0], c->value[1]);
+        break;
+      case op_expect_pin:
+        if (sim_gpio_level(c->value[0]) != c->value[1]) {
+          sim_host_fail(c, "%s", "pin level mismatch");
+        }
+        break;
+      case op_pm:
+        sim_i2c_set_pm(c->value[0], c->value[1], c->value[2]);
+        break;
+      case op_ads:
+        sim_i2c_set_ads(c->value[0], c->value[1], c->value[2]);
+        break;
+      case op_nack:
+        sim_i2c_nack(c->value[0], c->value[1]);
+        break;
+    }
+  }
+}
+
+/** Starts the script once the firmware has finished initializing */
+void sim_host_start(void) {
+  sim_event_at(sim_now_ns(), sim_host_step, 0);
+}
+
+bool sim_host_done(void) {
+  return sim_state == host_done;
+}
+
+int sim_host_failures(void) {
+  return sim_failures;
+}
+
+void sim_host_report(void) {
+  double span = (sim_last_reply_ns - sim_first_req_ns) / 1e9;
+  printf("requests: %u answered", (unsigned)sim_requests);
+  if (sim_requests && span > 0) {
+    printf(" in %.3f s, %.0f requests/s, latency mean %.1f us, worst %.1f us",
+      span, sim_requests / span,
+      sim_latency_total / 1e3 / sim_requests, sim_latency_worst / 1e3);
+  }
+  printf("\nother frames: %u, frames lost in RX FIFOs: %u\n",
+    (unsigned)sim_other_frames, (unsigned)sim_can_frames_lost());
+}
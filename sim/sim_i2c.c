@@ -0,0 +1,206 @@
+/** @file sim_i2c.c
+ * Mock of the HAL asynchronous I2C master with the two slaves on the
+ * board. A transfer occupies the bus for nine bit times per byte,
+ * address included, at the 100 kHz the board runs the bus, and then
+ * completes from the simulated SERCOM interrupt.
+ *
+ * 0x67 power monitor: any read returns three big-endian words, set by
+ *   the script as current, voltage and second voltage.
+ * 0x48 ADS1115: writes set the pointer register, and a 3-byte write to
+ *   pointer 1 loads the config register. Setting the OS bit starts a
+ *   conversion that completes after a scripted number of config reads,
+ *   with the result for the selected MUX input (AIN0-AIN1 is T1,
+ *   AIN2-AIN3 is T2).
+ */
+#include <string.h>
+#include <hal_i2c_m_async.h>
+#include "sim.h"
+
+#define SIM_I2C_BIT_NS 10000ULL
+#define SIM_I2C_PM_ADDR 0x67
+#define SIM_I2C_ADS_ADDR 0x48
+#define SIM_I2C_ADS_OS 0x8000
+#define SIM_I2C_ADS_MUX(cfg) (((cfg) >> 12) & 7)
+
+static struct i2c_m_async_desc *sim_i2c_desc;
+static bool sim_i2c_busy = false;
+static bool sim_i2c_read;
+static uint8_t *sim_i2c_buf;
+static uint16_t sim_i2c_len;
+static int32_t sim_i2c_result;
+
+static uint16_t sim_i2c_pm[3];
+
+static uint8_t sim_i2c_ads_ptr = 0;
+static uint16_t sim_i2c_ads_config = 0x8583; // Power-on default
+static uint16_t sim_i2c_ads_conv = 0;
+static uint16_t sim_i2c_ads_value[2];
+static int sim_i2c_ads_polls = 2;
+static int sim_i2c_ads_busy = 0; // Config reads left before the conversion is done
+
+static uint8_t sim_i2c_nack_addr;
+static int sim_i2c_nack_count = 0;
+
+void sim_i2c_set_pm(uint16_t i, uint16_t v, uint16_t v2) {
+  sim_i2c_pm[0] = i;
+  sim_i2c_pm[1] = v;
+  sim_i2c_pm[2] = v2;
+}
+
+/**
+ * @param polls The number of config reads that see a conversion in
+ *   progress, 0 for conversions that are always complete
+ */
+void sim_i2c_set_ads(uint16_t t1, uint16_t t2, int polls) {
+  sim_i2c_ads_value[0] = t1;
+  sim_i2c_ads_value[1] = t2;
+  sim_i2c_ads_polls = polls;
+}
+
+/** Makes the next count transfers to addr fail with I2C_NACK */
+void sim_i2c_nack(uint8_t addr, int count) {
+  sim_i2c_nack_addr = addr;
+  sim_i2c_nack_count = count;
+}
+
+static void sim_i2c_put16(uint8_t *buf, uint16_t len, int offset, uint16_t word) {
+  if (offset < len) buf[offset] = word >> 8;
+  if (offset + 1 < len) buf[offset+1] = word & 0xFF;
+}
+
+static int32_t sim_i2c_pm_transfer(void) {
+  int i;
+  if (sim_i2c_read) {
+    for (i = 0; i < 3; ++i) {
+      sim_i2c_put16(sim_i2c_buf, sim_i2c_len, 2*i, sim_i2c_pm[i]);
+    }
+  }
+  return I2C_OK;
+}
+
+static int32_t sim_i2c_ads_transfer(void) {
+  if (sim_i2c_read) {
+    uint16_t word;
+    if (sim_i2c_ads_ptr == 1) {
+      word = sim_i2c_ads_config & ~SIM_I2C_ADS_OS;
+      if (sim_i2c_ads_busy) {
+        --sim_i2c_ads_busy;
+      }
+      if (!sim_i2c_ads_busy) {
+        word |= SIM_I2C_ADS_OS;
+      }
+    } else {
+      word = sim_i2c_ads_conv;
+    }
+    sim_i2c_put16(sim_i2c_buf, sim_i2c_len, 0, word);
+    return I2C_OK;
+  }
+  if (sim_i2c_len >= 1) {
+    sim_i2c_ads_ptr = sim_i2c_buf[0] & 3;
+  }
+  if (sim_i2c_len >= 3 && sim_i2c_ads_ptr == 1) {
+    sim_i2c_ads_config = (sim_i2c_buf[1] << 8) | sim_i2c_buf[2];
+    if (sim_i2c_ads_config & SIM_I2C_ADS_OS) {
+      int mux = SIM_I2C_ADS_MUX(sim_i2c_ads_config);
+      sim_i2c_ads_conv = sim_i2c_ads_value[mux == 3 ? 1 : 0];
+      sim_i2c_ads_busy = sim_i2c_ads_polls + 1;
+    }
+  }
+  return I2C_OK;
+}
+
+/** The simulated SERCOM interrupt at the end of a transfer */
+static void sim_i2c_irq(void) {
+  struct i2c_m_async_desc *i2c = sim_i2c_desc;
+  if (sim_i2c_result != I2C_OK) {
+    if (i2c->i2c_cb.error) {
+      i2c->i2c_cb.error(i2c, sim_i2c_result);
+    }
+  } else if (sim_i2c_read) {
+    if (i2c->i2c_cb.rx_complete) {
+      i2c->i2c_cb.rx_complete(i2c);
+    }
+  } else if (i2c->i2c_cb.tx_complete) {
+    i2c->i2c_cb.tx_complete(i2c);
+  }
+}
+
+static void sim_i2c_done(void *arg) {
+  uint8_t addr = sim_i2c_desc->slave_addr;
+  (void)arg;
+  sim_i2c_busy = false;
+  if (sim_i2c_nack_count && addr == sim_i2c_nack_addr) {
+    --sim_i2c_nack_count;
+    sim_i2c_result = I2C_NACK;
+  } else if (addr == SIM_I2C_PM_ADDR) {
+    sim_i2c_result = sim_i2c_pm_transfer();
+  } else if (addr == SIM_I2C_ADS_ADDR) {
+    sim_i2c_result = sim_i2c_ads_transfer();
+  } else {
+    sim_i2c_result = I2C_NACK;
+  }
+  sim_irq_raise(sim_i2c_irq);
+}
+
+static int32_t sim_i2c_start(struct io_descriptor *const io, uint8_t *buf,
+                             uint16_t length, bool read) {
+  sim_clock_update();
+  (void)io;
+  if (sim_i2c_busy) {
+    return ERR_BUSY;
+  }
+  sim_i2c_busy = true;
+  sim_i2c_read = read;
+  sim_i2c_buf = buf;
+  sim_i2c_len = length;
+  sim_event_at(sim_now_ns() + 9 * (length + 1) * SIM_I2C_BIT_NS,
+    sim_i2c_done, 0);
+  return (int32_t)length;
+}
+
+static int32_t sim_i2c_io_write(struct io_descriptor *const io, const uint8_t *const buf, const uint16_t length) {
+  return sim_i2c_start(io, (uint8_t *)buf, length, false);
+}
+
+static int32_t sim_i2c_io_read(struct io_descriptor *const io, uint8_t *const buf, const uint16_t length) {
+  return sim_i2c_start(io, buf, length, true);
+}
+
+int32_t i2c_m_async_init(struct i2c_m_async_desc *const i2c, void *const hw) {
+  memset(i2c, 0, sizeof(*i2c));
+  i2c->device.hw = hw;
+  i2c->io.read = sim_i2c_io_read;
+  i2c->io.write = sim_i2c_io_write;
+  sim_i2c_desc = i2c;
+  return ERR_NONE;
+}
+
+int32_t i2c_m_async_enable(struct i2c_m_async_desc *const i2c) {
+  sim_clock_update();
+  (void)i2c;
+  return ERR_NONE;
+}
+
+int32_t i2c_m_async_set_slaveaddr(struct i2c_m_async_desc *const i2c, int16_t addr, int32_t addr_len) {
+  sim_clock_update();
+  (void)addr_len;
+  i2c->slave_addr = addr;
+  return ERR_NONE;
+}
+
+int32_t i2c_m_async_get_io_descriptor(struct i2c_m_async_desc *const i2c, struct io_descriptor **io) {
+  *io = &i2c->io;
+  return ERR_NONE;
+}
+
+int32_t i2c_m_async_register_callback(struct i2c_m_async_desc *const i2c, enum i2c_m_async_callback_type type,
+                                      FUNC_PTR func) {
+  switch (type) {
+    case I2C_M_ASYNC_ERROR: i2c->i2c_cb.error = (i2c_error_cb_t)func; break;
+    case I2C_M_ASYNC_TX_COMPLETE: i2c->i2c_cb.tx_complete = (i2c_complete_cb_t)func; break;
+    case I2C_M_ASYNC_RX_COMPLETE: i2c->i2c_cb.rx_complete = (i2c_complete_cb_t)func; break;
+    default:
+      return ERR_INVALID_ARG;
+  }
+  return ERR_NONE;
+}
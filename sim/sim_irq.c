@@ -0,0 +1,81 @@
+/** @file sim_irq.c
+ * Simulated interrupt masking for host builds. Code under test holds
+ * off interrupts with CRITICAL_SECTION_ENTER() or __disable_irq(), and
+ * simulated peripherals raise interrupts with sim_irq_raise(). A raised
+ * handler runs at once if interrupts are enabled, or when they are next
+ * enabled otherwise, just as a pending NVIC interrupt would.
+ */
+#include <stdbool.h>
+#include "sim.h"
+
+static int sim_irq_nesting = 0;
+static bool sim_irq_primask = false;
+static bool sim_irq_active = false;
+static void (*sim_irq_queue[SIM_IRQ_MAX])(void);
+static int sim_irq_n_pending = 0;
+
+static bool sim_irq_masked(void) {
+  return sim_irq_nesting > 0 || sim_irq_primask || sim_irq_active;
+}
+
+/**
+ * Runs pending handlers one at a time, in the order they were raised
+ */
+static void sim_irq_dispatch(void) {
+  while (sim_irq_n_pending && !sim_irq_masked()) {
+    void (*handler)(void) = sim_irq_queue[0];
+    int i;
+    for (i = 1; i < sim_irq_n_pending; ++i) {
+      sim_irq_queue[i-1] = sim_irq_queue[i];
+    }
+    --sim_irq_n_pending;
+    sim_irq_active = true;
+    handler();
+    sim_irq_active = false;
+  }
+}
+
+/**
+ * Requests a call to handler in interrupt context. A handler that is
+ * already pending is not queued twice, as with an NVIC pending bit.
+ */
+void sim_irq_raise(void (*handler)(void)) {
+  int i;
+  for (i = 0; i < sim_irq_n_pending; ++i) {
+    if (sim_irq_queue[i] == handler) return;
+  }
+  if (sim_irq_n_pending < SIM_IRQ_MAX) {
+    sim_irq_queue[sim_irq_n_pending++] = handler;
+  }
+  sim_irq_dispatch();
+}
+
+/** @return true if a raised handler is waiting for interrupts to be enabled */
+bool sim_irq_pending(void) {
+  return sim_irq_n_pending > 0;
+}
+
+/** @return true while a simulated handler is running */
+bool sim_irq_in_handler(void) {
+  return sim_irq_active;
+}
+
+void atomic_enter_critical(hal_atomic_t volatile *atomic) {
+  *atomic = 0;
+  ++sim_irq_nesting;
+}
+
+void atomic_leave_critical(hal_atomic_t volatile *atomic) {
+  (void)atomic;
+  --sim_irq_nesting;
+  sim_irq_dispatch();
+}
+
+void __disable_irq(void) {
+  sim_irq_primask = true;
+}
+
+void __enable_irq(void) {
+  sim_irq_primask = false;
+  sim_irq_dispatch();
+}
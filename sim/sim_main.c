@@ -0,0 +1,94 @@
+/** @file sim_main.c
+ * Entry point of the host simulation. Loads the script, then runs the
+ * firmware's main() (compiled as firmware_main()) until the script is
+ * finished, and reports request throughput and main loop timing.
+ *
+ * The executable is linked with --wrap=subbus_poll, so every pass of
+ * the firmware's main loop comes through __wrap_subbus_poll(). That
+ * starts the script on the first pass, marks the start of an iteration
+ * for the timing, stalls the loop when the script says it is busy, and
+ * also polls the serial command interface in control.c, which the
+ * firmware's main() does not call.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <utils_assert.h>
+#include "control.h"
+#include "sim.h"
+
+bool sim_verbose = false;
+static bool sim_uart_polled = true;
+
+int firmware_main(void);
+void __real_subbus_poll(void);
+
+void __wrap_subbus_poll(void) {
+  static bool started = false;
+  sim_loop_begin();
+  if (!started) {
+    // The firmware has finished initializing
+    started = true;
+    sim_host_start();
+  }
+  sim_clock_update();
+  if (sim_host_done()) {
+    sim_finish();
+  }
+  sim_busy_run();
+  __real_subbus_poll();
+  if (sim_uart_polled) {
+    poll_control();
+  }
+}
+
+/** The ASF assert() behind ASSERT() and the firmware's assert() calls */
+void assert(const bool condition, const char *const file, const int line) {
+  if (!condition) {
+    fprintf(stderr, "sim: assertion failed at %s:%d\n", file, line);
+    exit(2);
+  }
+}
+
+/** Reports and exits, nonzero if any expectation failed */
+void sim_finish(void) {
+  uint64_t n = sim_loop_iterations();
+  sim_host_report();
+  printf("main loop: %llu iterations, worst %.1f us, mean %.2f us (host time)\n",
+    (unsigned long long)n, sim_loop_worst_ns() / 1e3,
+    n ? sim_loop_busy_ns() / 1e3 / n : 0.0);
+  if (sim_host_failures()) {
+    printf("%d failures\n", sim_host_failures());
+    exit(1);
+  }
+  exit(0);
+}
+
+static void sim_usage(const char *prog) {
+  fprintf(stderr, "usage: %s [-v] [-n] script\n"
+    "  -v  trace frames, serial lines and output pins\n"
+    "  -n  do not poll the serial command interface\n", prog);
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  int opt;
+  while ((opt = getopt(argc, argv, "vn")) != -1) {
+    switch (opt) {
+      case 'v': sim_verbose = true; break;
+      case 'n': sim_uart_polled = false; break;
+      default: sim_usage(argv[0]);
+    }
+  }
+  if (optind != argc-1) {
+    sim_usage(argv[0]);
+  }
+  if (!sim_host_load(argv[optind])) {
+    perror(argv[optind]);
+    return 2;
+  }
+  setvbuf(stdout, NULL, _IOLBF, 0);
+  sim_host_ns(); // Virtual time starts now
+  return firmware_main();
+}
@@ -0,0 +1,110 @@
+/** @file sim_uart.c
+ * Mock of the HAL asynchronous USART. Received characters go through
+ * the HAL's ring buffer as on the board. Transmission completes within
+ * io_write(): usart.c spins on USART_Diag_tx_busy without any HAL call
+ * that could let virtual time advance, so a timed transmitter would
+ * never finish. Output is collected into lines for sim_host.c.
+ */
+#include <string.h>
+#include <hal_usart_async.h>
+#include "sim.h"
+
+#define SIM_UART_LINE_MAX 256
+
+static struct usart_async_descriptor *sim_uart_descr;
+static bool sim_uart_enabled = false;
+static char sim_uart_line[SIM_UART_LINE_MAX];
+static int sim_uart_nc = 0;
+
+static void sim_uart_tx_irq(void) {
+  if (sim_uart_descr->usart_cb.tx_done) {
+    sim_uart_descr->usart_cb.tx_done(sim_uart_descr);
+  }
+}
+
+static void sim_uart_rx_irq(void) {
+  if (sim_uart_descr->usart_cb.rx_done) {
+    sim_uart_descr->usart_cb.rx_done(sim_uart_descr);
+  }
+}
+
+static int32_t sim_uart_io_write(struct io_descriptor *const io, const uint8_t *const buf, const uint16_t length) {
+  int i;
+  (void)io;
+  sim_clock_update();
+  for (i = 0; i < length; ++i) {
+    if (buf[i] == '\n') {
+      sim_uart_line[sim_uart_nc] = '\0';
+      sim_uart_nc = 0;
+      sim_host_uart_line(sim_uart_line);
+    } else if (sim_uart_nc < SIM_UART_LINE_MAX-1) {
+      sim_uart_line[sim_uart_nc++] = buf[i];
+    }
+  }
+  sim_irq_raise(sim_uart_tx_irq);
+  return (int32_t)length;
+}
+
+static int32_t sim_uart_io_read(struct io_descriptor *const io, uint8_t *const buf, const uint16_t length) {
+  uint16_t was_read = 0;
+  uint32_t num;
+  (void)io;
+  sim_clock_update();
+  CRITICAL_SECTION_ENTER()
+  num = ringbuffer_num(&sim_uart_descr->rx);
+  CRITICAL_SECTION_LEAVE()
+  while (was_read < num && was_read < length) {
+    ringbuffer_get(&sim_uart_descr->rx, &buf[was_read++]);
+  }
+  return (int32_t)was_read;
+}
+
+/** Delivers text to the receiver, one interrupt per character */
+void sim_uart_send(const char *text) {
+  if (!sim_uart_enabled) return;
+  while (*text) {
+    ringbuffer_put(&sim_uart_descr->rx, (uint8_t)*text++);
+    sim_irq_raise(sim_uart_rx_irq);
+  }
+}
+
+int32_t usart_async_init(struct usart_async_descriptor *const descr, void *const hw, uint8_t *rx_buffer,
+                         uint16_t rx_buffer_length, void *const func) {
+  (void)func;
+  memset(descr, 0, sizeof(*descr));
+  if (ERR_NONE != ringbuffer_init(&descr->rx, rx_buffer, rx_buffer_length)) {
+    return ERR_INVALID_ARG;
+  }
+  descr->device.hw = hw;
+  descr->io.read = sim_uart_io_read;
+  descr->io.write = sim_uart_io_write;
+  sim_uart_descr = descr;
+  return ERR_NONE;
+}
+
+int32_t usart_async_enable(struct usart_async_descriptor *const descr) {
+  (void)descr;
+  sim_uart_enabled = true;
+  return ERR_NONE;
+}
+
+int32_t usart_async_get_io_descriptor(struct usart_async_descriptor *const descr, struct io_descriptor **io) {
+  *io = &descr->io;
+  return ERR_NONE;
+}
+
+int32_t usart_async_register_callback(struct usart_async_descriptor *const descr,
+                                      const enum usart_async_callback_type type, usart_cb_t cb) {
+  switch (type) {
+    case USART_ASYNC_RXC_CB: descr->usart_cb.rx_done = cb; break;
+    case USART_ASYNC_TXC_CB: descr->usart_cb.tx_done = cb; break;
+    case USART_ASYNC_ERROR_CB: descr->usart_cb.error = cb; break;
+    default:
+      return ERR_INVALID_ARG;
+  }
+  return ERR_NONE;
+}
+
+int32_t usart_async_flush_rx_buffer(struct usart_async_descriptor *const descr) {
+  return ringbuffer_flush(&descr->rx);
+}